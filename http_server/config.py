@@ -3,6 +3,26 @@ SERVER_HOST = "192.168.0.34"
 #SERVER_HOST = "localhost"
 SERVER_PORT = 9000
 
+# UDP measurement datagrams, set UDP_PORT to None to disable. Datagrams carry
+# no resource path, so are logged under UDP_DEVICE.
+UDP_PORT = 9001
+UDP_DEVICE = "cc3000"
+
+# Each HTTP connection is handled by one of HTTP_WORKERS threads. Connections
+# kept alive are closed after HTTP_IDLE_TIMEOUT seconds without a request, and
+# once HTTP_MAX_PENDING are waiting for a worker further ones are refused.
+HTTP_WORKERS = 16
+HTTP_MAX_PENDING = 64
+HTTP_IDLE_TIMEOUT = 5
+
+# Graphs are GRAPH_WIDTH by GRAPH_HEIGHT pixels unless the request gives a
+# width and height, up to GRAPH_MAX_SIZE. The last GRAPH_CACHE_SIZE rendered
+# are kept until their resource is next written to.
+GRAPH_WIDTH = 640
+GRAPH_HEIGHT = 480
+GRAPH_MAX_SIZE = 2000
+GRAPH_CACHE_SIZE = 64
+
 DATA_DIR = "./data/"
 HTTP_ROOT_FILE = "root_header.html"
 
@@ -25,19 +25,69 @@
 ################################################################################
 
 import matplotlib.pyplot as pyplot
+import numpy
 import log_data
 import io
 import config
+from collections import OrderedDict
+from threading import Lock
 
-def get_graph_device_resource(device, resource):
-    ts,da,un = log_data.get_device_resource_lists(device, resource)
-    ts.pop(0)
-    da.pop(0)
-    un.pop(0)
-    if(len(set(un)) != 1):
+GRAPH_DPI = 100
+# Rendered PNGs by (device, resource, width, height, start, end), each with the
+# version of the resource it was drawn from. Least recently used first.
+GRAPH_CACHE = OrderedDict()
+GRAPH_CACHE_LOCK = Lock()
+# pyplot isn't thread safe
+GRAPH_LOCK = Lock()
+
+def downsample_lttb(x, y, threshold):
+    """Largest-Triangle-Three-Buckets: picks threshold of the points, keeping
+    the first and last, that best preserve the shape of the series. x must be
+    in ascending order."""
+    n = len(x)
+    if threshold >= n or threshold < 3:
+        return (x, y)
+    # Bucket edges for the points between the first and last
+    edges = numpy.linspace(1, n - 1, threshold - 1).astype(int)
+    selected = numpy.empty(threshold, dtype = int)
+    selected[0] = 0
+    selected[-1] = n - 1
+    prev = 0
+    for i in range(threshold - 2):
+        start, end = edges[i], edges[i + 1]
+        if i + 2 < len(edges):
+            next_x = x[end:edges[i + 2]].mean()
+            next_y = y[end:edges[i + 2]].mean()
+        else:
+            next_x, next_y = x[-1], y[-1]
+        # Twice the area of the triangle each candidate makes with the last
+        # selected point and the average of the next bucket
+        area = numpy.abs((x[prev] - next_x) * (y[start:end] - y[prev]) -
+                         (x[prev] - x[start:end]) * (next_y - y[prev]))
+        prev = start + int(numpy.argmax(area))
+        selected[i + 1] = prev
+    return (x[selected], y[selected])
+
+def get_downsampled_arrays(device, resource, width, start = None, end = None):
+    """Returns the times, values and units of a resource with no more points
+    than there are pixels across the graph."""
+    ts,da,un = log_data.get_device_resource_arrays(device, resource,
+                                                   start, end)
+    if(len(un) != 1):
         raise Exception("Units not all the same")
-    units = un[0]
-    fig = pyplot.figure()
+    finite = numpy.isfinite(da)
+    ts,da = downsample_lttb(ts[finite], da[finite], width)
+    return (ts, da, un[0])
+
+def get_graph_device_resource(device, resource, width = None, height = None,
+                              start = None, end = None):
+    if width is None:
+        fig = pyplot.figure()
+        width = config.GRAPH_WIDTH
+    else:
+        fig = pyplot.figure(figsize = (width / GRAPH_DPI, height / GRAPH_DPI),
+                            dpi = GRAPH_DPI)
+    ts,da,units = get_downsampled_arrays(device, resource, width, start, end)
     axis = fig.add_subplot(1,1,1)
     axis.scatter(ts, da)
     fig.suptitle("Graph of " + resource + " from " +  device)
@@ -57,13 +107,8 @@ def get_graph_device(device):
             axis = axis1
         else:
             axis = fig.add_subplot(len(resources), 1, ctr, sharex=axis1)
-        ts,da,un = log_data.get_device_resource_lists(device, resource)
-        ts.pop(0)
-        da.pop(0)
-        un.pop(0)
-        if(len(set(un)) != 1):
-            raise Exception("Units not all the same")
-        units = un[0]
+        ts,da,units = get_downsampled_arrays(device, resource,
+                                             config.GRAPH_WIDTH)
         axis.scatter(ts, da)
         axis.set_xlabel("Time (s)")
         axis.xaxis.set_tick_params(labelsize=10)
@@ -82,18 +127,38 @@ def show_graph_device_resource(device, resource):
 def show_graph_device(device):
     get_graph_device(device).show()
     
-def open_png_graph_device_resource(device,resource):
-    plot = get_graph_device_resource(device, resource)
-    buf = io.BytesIO()
-    plot.savefig(buf, format = 'png')
-    buf.seek(0)
-    png = buf.read()
+def render_png_graph_device_resource(device, resource, width, height,
+                                     start, end):
+    with GRAPH_LOCK:
+        plot = get_graph_device_resource(device, resource, width, height,
+                                         start, end)
+        buf = io.BytesIO()
+        plot.savefig(buf, format = 'png', dpi = GRAPH_DPI)
+        pyplot.close(plot)
+    png = buf.getvalue()
     buf.close()
+    return png
 
-    f = open(config.DATA_DIR + "last_opened.png", "wb")
-    f.write(png)
-    f.close()
-
+def open_png_graph_device_resource(device, resource,
+                                   width = config.GRAPH_WIDTH,
+                                   height = config.GRAPH_HEIGHT,
+                                   start = None, end = None):
+    """Returns the graph as a PNG, only drawing it if the resource has been
+    written to since it was last drawn at this size and time range."""
+    key = (device, resource, width, height, start, end)
+    version = log_data.get_version(device, resource)
+    with GRAPH_CACHE_LOCK:
+        cached = GRAPH_CACHE.get(key)
+        if cached is not None and cached[0] == version:
+            GRAPH_CACHE.move_to_end(key)
+            return cached[1]
+    png = render_png_graph_device_resource(device, resource, width, height,
+                                           start, end)
+    with GRAPH_CACHE_LOCK:
+        GRAPH_CACHE[key] = (version, png)
+        GRAPH_CACHE.move_to_end(key)
+        while len(GRAPH_CACHE) > config.GRAPH_CACHE_SIZE:
+            GRAPH_CACHE.popitem(last = False)
     return png
 
 #def open_png_graph_device(device):
@@ -27,34 +27,283 @@
 import time
 import csv
 import os.path
+import struct
+import mmap
+from threading import Lock
+import numpy
 import config
 
 URL_LOG_EXT = ".csv"
+BATCH_RESOURCE = "batch"
+
+# Each device/resource is an append-only segment of fixed width records:
+# microseconds since the epoch, value, and the ids of the units and host
+# strings. Ids index the lines of STRINGS_FILE, which is only ever appended to.
+SEGMENT_EXT = ".seg"
+SEGMENT_RECORD = struct.Struct("<qdHH")
+SEGMENT_DTYPE = numpy.dtype([("time_us", "<i8"), ("value", "<f8"),
+                             ("units", "<u2"), ("host", "<u2")])
+STRINGS_FILE = ".strings"
+STRINGS = []
+STRING_IDS = {}
+STRINGS_LOCK = Lock()
+# Newest (timestamp, value, units, host) of each (device, resource), kept up
+# to date by the writes below and rebuilt from the segment tails at start up.
+LATEST = {}
+LATEST_LOCK = Lock()
+# Count of writes to each (device, resource) since start up, so readers can
+# tell if something derived from a segment is stale.
+VERSIONS = {}
+
+# Binary measurement records, must match fyp.h on the device.
+# sensor id, unit code, scaled value, seconds since 2000-01-01
+BINARY_CONTENT_TYPE = "application/x-fyp-measurements"
+BINARY_RECORD = struct.Struct("<BBiI")
+BINARY_EPOCH = 946684800
+BINARY_SENSOR_IDS = {1 : "lux", 2 : "temperature", 3 : "pressure"}
+# unit code : (units, scale, decimal places)
+BINARY_UNIT_CODES = {1 : ("lx", 1, 0), 2 : ("K", 100, 2), 3 : ("kPa", 100, 2)}
+# UDP datagrams are a header of version, flags and sequence number followed by
+# binary records. Acks echo the header with UDP_FLAG_ACK set. Must match
+# udp_upload.c.
+UDP_HEADER = struct.Struct("<BBI")
+UDP_VERSION = 1
+UDP_FLAG_ACK_REQUESTED = 0x01
+UDP_FLAG_ACK = 0x02
+UDP_MAX_DATAGRAM = 512
+
+# A batch body carries one "resource data units" measurement per line.
+def parse_batch(body):
+    measurements = []
+    for line in body.splitlines():
+        fields = line.split()
+        if len(fields) < 2:
+            continue
+        if len(fields) == 3:
+            units = fields[2]
+        else:
+            units = "UNITS"
+        measurements.append((fields[0], fields[1], units, None))
+    return measurements
+
+# Returns the same (resource, data, units, timestamp) tuples as parse_batch.
+# Records with an unknown sensor or unit are skipped.
+def decode_binary(body):
+    measurements = []
+    for offset in range(0, len(body) - BINARY_RECORD.size + 1, BINARY_RECORD.size):
+        sensor, unit, value, sample_time = BINARY_RECORD.unpack_from(body, offset)
+        if sensor not in BINARY_SENSOR_IDS or unit not in BINARY_UNIT_CODES:
+            continue
+        units, scale, places = BINARY_UNIT_CODES[unit]
+        data = "%.*f" % (places, value / scale)
+        if sample_time == 0:
+            timestamp = None
+        else:
+            timestamp = BINARY_EPOCH + sample_time
+        measurements.append((BINARY_SENSOR_IDS[sensor], data, units, timestamp))
+    return measurements
+
+def decode_datagram(datagram):
+    """Returns (sequence, ack_requested, measurements) or None if the datagram
+    isn't one of ours."""
+    if len(datagram) < UDP_HEADER.size:
+        return None
+    version, flags, sequence = UDP_HEADER.unpack_from(datagram)
+    if version != UDP_VERSION:
+        return None
+    measurements = decode_binary(datagram[UDP_HEADER.size:])
+    return (sequence, (flags & UDP_FLAG_ACK_REQUESTED) != 0, measurements)
+
+def encode_ack(sequence):
+    return UDP_HEADER.pack(UDP_VERSION, UDP_FLAG_ACK, sequence)
+
 CSV_HEADER = ["IP", "TIMESTAMP", "DATA", "UNITS"]
 
-def open_csv_file_write(path):
+def load_strings():
+    path = config.DATA_DIR + STRINGS_FILE
+    if len(STRINGS) > 0 or os.path.exists(path) == False:
+        return
+    f = open(path, "r")
+    for line in f.read().splitlines():
+        STRING_IDS[line] = len(STRINGS)
+        STRINGS.append(line)
+    f.close()
+
+def intern_string(string):
+    with STRINGS_LOCK:
+        load_strings()
+        string_id = STRING_IDS.get(string)
+        if string_id is None:
+            string_id = len(STRINGS)
+            f = open(config.DATA_DIR + STRINGS_FILE, "a")
+            f.write(string + "\n")
+            f.close()
+            STRING_IDS[string] = string_id
+            STRINGS.append(string)
+        return string_id
+
+def string_from_id(string_id):
+    if string_id >= len(STRINGS):
+        with STRINGS_LOCK:
+            load_strings()
+    return STRINGS[string_id]
+
+def segment_path(device, resource):
+    return config.DATA_DIR + device + "/" + resource + SEGMENT_EXT
+
+def pack_measurement(host, data, units, sys_time = None):
+    """Raises ValueError if data isn't a number."""
+    if sys_time is None:
+        sys_time = time.time()
+    return SEGMENT_RECORD.pack(int(round(float(sys_time) * 1000000)),
+                               float(data), intern_string(units),
+                               intern_string(host))
+
+def unpack_record(record):
+    """Returns (timestamp, value, units, host) from a segment record."""
+    time_us, value, units_id, host_id = record
+    return (time_us / 1000000, value, string_from_id(units_id),
+            string_from_id(host_id))
+
+def append_to_segment(path, records):
     if os.path.exists(os.path.dirname(path)) == False:
         os.makedirs(os.path.dirname(path))
-    if os.path.exists(path) == False:
-        open_mode = "w"
-    else:
-        open_mode = "a"
-    f = open(path, open_mode)
-    c = csv.writer(f)
-    if open_mode is "w":
-        c.writerow(CSV_HEADER)
-    return f
-
-def close_csv_file(f):
+    # One write so a reader never sees part of a batch's record
+    fd = os.open(path, os.O_WRONLY | os.O_APPEND | os.O_CREAT, 0o644)
+    os.write(fd, records)
+    os.close(fd)
+
+def set_latest(device, resource, record):
+    with LATEST_LOCK:
+        LATEST[(device, resource)] = unpack_record(SEGMENT_RECORD.unpack(record))
+        VERSIONS[(device, resource)] = VERSIONS.get((device, resource), 0) + 1
+
+def get_version(device, resource):
+    with LATEST_LOCK:
+        return VERSIONS.get((device, resource), 0)
+
+def write_measurement(device, resource, host, data, units, sys_time = None):
+    record = pack_measurement(host, data, units, sys_time)
+    append_to_segment(segment_path(device, resource), record)
+    set_latest(device, resource, record)
+
+def write_batch(device, host, measurements):
+    """Measurements that aren't numbers are skipped."""
+    records = {}
+    for (resource, data, units, timestamp) in measurements:
+        try:
+            record = pack_measurement(host, data, units, timestamp)
+        except ValueError:
+            continue
+        records.setdefault(resource, []).append(record)
+    for resource in records:
+        append_to_segment(segment_path(device, resource),
+                          b"".join(records[resource]))
+        set_latest(device, resource, records[resource][-1])
+
+def open_segment_read(path):
+    """Maps the whole records of a segment read only, None if it has none.
+    Records appended afterwards aren't seen by this mapping."""
+    f = open(path, "rb")
+    size = os.fstat(f.fileno()).st_size
+    size -= size % SEGMENT_RECORD.size
+    m = None
+    if size > 0:
+        m = mmap.mmap(f.fileno(), size, access = mmap.ACCESS_READ)
+    f.close()
+    return m
+
+def get_segment_records(device, resource):
+    """Returns the raw record tuples of a segment."""
+    m = open_segment_read(segment_path(device, resource))
+    if m is None:
+        return []
+    view = memoryview(m)
+    records = list(SEGMENT_RECORD.iter_unpack(view))
+    view.release()
+    m.close()
+    return records
+
+def get_last_measurement(device, resource):
+    """Returns (timestamp, value, units, host) of the newest record, or None."""
+    f = open(segment_path(device, resource), "rb")
+    size = os.fstat(f.fileno()).st_size
+    size -= size % SEGMENT_RECORD.size
+    last = None
+    if size > 0:
+        f.seek(size - SEGMENT_RECORD.size)
+        last = unpack_record(SEGMENT_RECORD.unpack(f.read(SEGMENT_RECORD.size)))
     f.close()
+    return last
 
-def open_csv_file_read(path):
-    return open(path, "r")
-    
-def write_measurement_to_csv(f, host, data, units):
-    sys_time = time.time()
-    c = csv.writer(f)
-    c.writerow([host,sys_time,data,units])
+def build_latest_index():
+    latest = {}
+    for device in get_devices():
+        for resource in get_device_resources(device):
+            last = get_last_measurement(device, resource)
+            if last is not None:
+                latest[(device, resource)] = last
+    with LATEST_LOCK:
+        LATEST.clear()
+        LATEST.update(latest)
+
+def get_latest(device, resource):
+    """As get_last_measurement, but from the index where possible."""
+    with LATEST_LOCK:
+        last = LATEST.get((device, resource))
+    if last is None:
+        last = get_last_measurement(device, resource)
+    return last
+
+def get_all_latest():
+    """Returns ((device, resource), measurement) pairs sorted by name."""
+    with LATEST_LOCK:
+        return sorted(LATEST.items())
+
+def format_value(value):
+    return "%.15g" % value
+
+def format_timestamp(timestamp):
+    return "%.6f" % timestamp
+
+def export_csv(device, resource):
+    """Renders a segment in the CSV layout the logs used to be stored in."""
+    lines = [",".join(CSV_HEADER)]
+    for record in get_segment_records(device, resource):
+        timestamp, value, units, host = unpack_record(record)
+        lines.append(host + "," + format_timestamp(timestamp) + "," +
+                     format_value(value) + "," + units)
+    lines.append("")
+    return "\r\n".join(lines)
+
+def import_csv_logs():
+    """Converts CSV logs from before the segment store, unless the resource
+    already has a segment or the log has no values. The CSV files are left in
+    place."""
+    for device in get_devices():
+        device_path = config.DATA_DIR + device + "/"
+        for name in os.listdir(device_path):
+            resource, ext = os.path.splitext(name)
+            if ext != URL_LOG_EXT:
+                continue
+            if os.path.exists(device_path + resource + SEGMENT_EXT):
+                continue
+            f = open(device_path + name, "r")
+            records = []
+            for row in csv.reader(f):
+                if len(row) != len(CSV_HEADER) or row == CSV_HEADER:
+                    continue
+                try:
+                    records.append(pack_measurement(row[0], row[2], row[3],
+                                                    row[1]))
+                except ValueError:
+                    continue
+            f.close()
+            if len(records) == 0:
+                continue
+            print("Imported " + device + "/" + name)
+            append_to_segment(device_path + resource + SEGMENT_EXT,
+                              b"".join(records))
 
 def get_devices():
     full_list = os.listdir(config.DATA_DIR)
@@ -77,23 +326,32 @@ def get_device_resources(device):
             continue
         h,t = os.path.split(u)
         r,e = os.path.splitext(t)
-        if e != URL_LOG_EXT:
+        if e != SEGMENT_EXT:
             continue
         resources.append(r)
     return resources
 
-def get_device_resource_lists(device, resource):
-    path = config.DATA_DIR + "/" + device + "/" + resource + URL_LOG_EXT
-    f = open_csv_file_read(path)
-    c = csv.reader(f)
-    time_list = []
-    data_list = []
-    unit_list = []
-    for row in c:
-        time_list.append(row[1])
-        data_list.append(row[2])
-        unit_list.append(row[3])
-    f.close()
-    return (time_list, data_list, unit_list)
-
-
+def get_device_resource_arrays(device, resource, start = None, end = None):
+    """Returns numpy arrays of the timestamps and values of a resource in time
+    order, optionally only those from start to end seconds since the epoch,
+    and the list of units used anywhere in the resource."""
+    m = open_segment_read(segment_path(device, resource))
+    if m is None:
+        return (numpy.empty(0), numpy.empty(0), [])
+    records = numpy.frombuffer(m, dtype = SEGMENT_DTYPE)
+    units = [string_from_id(int(u)) for u in numpy.unique(records["units"])]
+    selected = numpy.ones(len(records), dtype = bool)
+    if start is not None:
+        selected &= records["time_us"] >= start * 1000000
+    if end is not None:
+        selected &= records["time_us"] <= end * 1000000
+    times = records["time_us"][selected] / 1000000
+    values = records["value"][selected]
+    del records
+    m.close()
+    # Batches a device buffered can arrive after newer readings
+    if numpy.any(times[1:] < times[:-1]):
+        order = numpy.argsort(times, kind = "stable")
+        times = times[order]
+        values = values[order]
+    return (times, values, units)
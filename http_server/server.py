@@ -25,12 +25,15 @@
 ################################################################################
 
 from http.server import BaseHTTPRequestHandler, HTTPServer
-from http.client import InvalidURL, OK
-from threading import Thread
+from http.client import InvalidURL, OK, BAD_REQUEST, NOT_FOUND
+from threading import Thread, Lock, BoundedSemaphore
+from concurrent.futures import ThreadPoolExecutor
 import log_data
 import graph_data
 import time
 import os
+import socket
+import urllib.parse
 import config
 if config.USE_I2C_MATRIX == True:
     import i2c_led_matrix_8
@@ -38,25 +41,54 @@ if config.USE_I2C_MATRIX == True:
 HTTP_SERVER_RUNNING = False
 HTTP_SERVER_THREAD = None
 HTTP_SERVER = None
+UDP_SERVER_THREAD = None
+UDP_SERVER_SOCKET = None
+# Requests are handled concurrently, writes to the logs are serialised.
+STORE_LOCK = Lock()
+# Latest value of every device's resources in one response
+LATEST_URL = "/latest"
+BUSY_RESPONSE = b"HTTP/1.1 503 Service Unavailable\r\n" \
+                b"Content-Length: 0\r\nConnection: close\r\n\r\n"
 
-class Handler(BaseHTTPRequestHandler):
-    def get_file(self, path):
-        return log_data.open_csv_file_write(path)
+class PooledHTTPServer(HTTPServer):
+    """Hands each connection to a bounded pool of threads, so a client that
+    keeps its connection open only ties up its own worker until the idle
+    timeout. Connections beyond the pool and max_pending are refused."""
+    def __init__(self, address, handler, workers, max_pending):
+        HTTPServer.__init__(self, address, handler)
+        self.pool = ThreadPoolExecutor(max_workers = workers)
+        self.slots = BoundedSemaphore(workers + max_pending)
+
+    def process_request(self, request, client_address):
+        if self.slots.acquire(blocking = False) == False:
+            try:
+                request.sendall(BUSY_RESPONSE)
+            except OSError:
+                pass
+            self.shutdown_request(request)
+            return
+        self.pool.submit(self.process_request_worker, request, client_address)
+
+    def process_request_worker(self, request, client_address):
+        try:
+            self.finish_request(request, client_address)
+        except Exception:
+            self.handle_error(request, client_address)
+        finally:
+            self.shutdown_request(request)
+            self.slots.release()
 
-    def close_file(self, f):
-        log_data.close_csv_file(f)
+    def server_close(self):
+        HTTPServer.server_close(self)
+        self.pool.shutdown(wait = True)
 
+class Handler(BaseHTTPRequestHandler):
 #http://stackoverflow.com/questions/2617615/slow-python-http-server-on-localhost
     def address_string(self):
         host, port = self.client_address[:2]
         return host
 
 # TODO what if path is bad, no leading forward slash etc XXX
-    def path_to_local(self):
-        if self.path == "/":
-            raise InvalidURL("Invalid Resource:", self.path)
-        return config.DATA_DIR + self.path + log_data.URL_LOG_EXT
- 
     def path_to_device_resource(self, path):
         path, ext = os.path.splitext(path)
         if path.count("/") != 2:
@@ -64,7 +96,7 @@ class Handler(BaseHTTPRequestHandler):
         split_path = path.split("/")
         return (split_path[1], split_path[2])
 
-    def log_data(self, log_file):
+    def log_data(self):
         host,port = self.client_address
         body_len = int(self.headers.get('content-length'))
         body = self.rfile.read(body_len).decode().split()
@@ -74,21 +106,64 @@ class Handler(BaseHTTPRequestHandler):
             units = body[1]
         else:
             units = "UNITS"
-        log_data.write_measurement_to_csv(log_file, host, data, units)
+        dev,res = self.path_to_device_resource(self.path)
+        with STORE_LOCK:
+            log_data.write_measurement(dev, res, host, data, units)
         return (data, units)
 
     def handle_lux(self, lux):
         i2c_led_matrix_8.update_scaled(int(lux))
 
+    def log_batch(self):
+        host,port = self.client_address
+        body_len = int(self.headers.get('content-length'))
+        body = self.rfile.read(body_len)
+        if self.headers.get('content-type') == log_data.BINARY_CONTENT_TYPE:
+            measurements = log_data.decode_binary(body)
+        else:
+            measurements = log_data.parse_batch(body.decode())
+        dev,res = self.path_to_device_resource(self.path)
+        with STORE_LOCK:
+            log_data.write_batch(dev, host, measurements)
+        return measurements
+
     def do_POST(self):
-        path = self.path_to_local()
-        f = self.get_file(path)
-        #self.end_headers()
-        (data, units) = self.log_data(f)
-        self.close_file(f)
+        if (os.path.basename(self.path) == log_data.BATCH_RESOURCE or
+            self.headers.get('content-type') == log_data.BINARY_CONTENT_TYPE):
+            measurements = self.log_batch()
+        else:
+            try:
+                (data, units) = self.log_data()
+            except ValueError:
+                self.send_error(BAD_REQUEST, "Measurement is not a number")
+                return
+            measurements = [(os.path.basename(self.path), data, units, None)]
         self.send_response(OK, "OK")
-        if config.USE_I2C_MATRIX == True and "lux" in path:
-            self.handle_lux(data)
+        self.send_header("Content-length", "0")
+        self.end_headers()
+        if config.USE_I2C_MATRIX == True:
+            for (resource, data, units, timestamp) in measurements:
+                if "lux" in resource:
+                    self.handle_lux(data)
+
+    def graph_query(self, query):
+        """Returns the width, height, start and end asked for in a graph query,
+        for example "width=800&height=300&start=1400000000". Start and end are
+        seconds since the epoch, None if not given. Raises ValueError if a
+        parameter is invalid."""
+        q = urllib.parse.parse_qs(query)
+        width = int(q.get("width", [config.GRAPH_WIDTH])[0])
+        height = int(q.get("height", [config.GRAPH_HEIGHT])[0])
+        for size in (width, height):
+            if size < 1 or size > config.GRAPH_MAX_SIZE:
+                raise ValueError("Graph size out of range")
+        start = q.get("start")
+        if start is not None:
+            start = float(start[0])
+        end = q.get("end")
+        if end is not None:
+            end = float(end[0])
+        return (width, height, start, end)
 
     def html_make_link(self,url,text):
         href_start = "<a href=\""
@@ -102,6 +177,7 @@ class Handler(BaseHTTPRequestHandler):
         f.close()
 
         reply = reply + "<h2 id=\"Resources\">Resources</h2>\n"
+        reply = reply + "<p>" + self.html_make_link(LATEST_URL[1:], "latest of all") + "</p>\n"
 
         # Make table
         devices = log_data.get_devices()
@@ -142,14 +218,36 @@ class Handler(BaseHTTPRequestHandler):
         self.wfile.write(reply.encode(encoding="UTF-8"))
 
     def do_GET(self):
+        url = urllib.parse.urlsplit(self.path)
+
         # Get Root
         if (self.path == "/"):  
             self.send_root_html()
 
+        # Get latest value of every resource
+        elif self.path == LATEST_URL:
+            s = "DEVICE, RESOURCE, TIMESTAMP, DATA, UNIT\n"
+            for (dev, res), (t, d, u, h) in log_data.get_all_latest():
+                s += (dev + "," + res + "," + log_data.format_timestamp(t) +
+                      "," + log_data.format_value(d) + "," + u + "\n")
+            s = s.encode(encoding="UTF-8")
+            self.send_response(OK, "OK")
+            self.send_header("Content-type", "text/plain")
+            self.send_header("Content-length", str(len(s)))
+            self.end_headers()
+            self.wfile.write(s)
+
         # Get Graph
-        elif self.path.endswith(".graph"):
-            dev,res = self.path_to_device_resource(self.path)
-            png = graph_data.open_png_graph_device_resource(dev,res)
+        elif url.path.endswith(".graph"):
+            dev,res = self.path_to_device_resource(url.path)
+            try:
+                width, height, start, end = self.graph_query(url.query)
+            except ValueError:
+                self.send_error(BAD_REQUEST, "Invalid graph query")
+                return
+            png = graph_data.open_png_graph_device_resource(dev, res,
+                                                            width, height,
+                                                            start, end)
             self.send_response(OK, "OK")
             self.send_header("Content-type","image/png")
             self.send_header("Content-length", str(len(png)))
@@ -157,8 +255,23 @@ class Handler(BaseHTTPRequestHandler):
             self.wfile.write(png)
             self.wfile.flush()
 
-        # Get CSV
-        elif os.path.isfile(config.DATA_DIR + self.path):
+        # Get CSV, exported from the segment
+        elif (self.path.endswith(log_data.URL_LOG_EXT) and
+              os.path.isfile(config.DATA_DIR + self.path[:-len(log_data.URL_LOG_EXT)]
+                             + log_data.SEGMENT_EXT)):
+            dev,res = self.path_to_device_resource(self.path)
+            reply = log_data.export_csv(dev, res).encode(encoding="UTF-8")
+            self.send_response(OK, "OK")
+            self.send_header("Content-type", "text/plain")
+            self.send_header("Content-length", str(len(reply)))
+            self.end_headers()
+            self.wfile.write(reply)
+
+        # Get file, such as a CSV log not yet imported. The store's own
+        # segment and hidden files aren't served.
+        elif ("/." not in self.path and
+              self.path.endswith(log_data.SEGMENT_EXT) == False and
+              os.path.isfile(config.DATA_DIR + self.path)):
             f=open(config.DATA_DIR + self.path, "rb")
             self.send_response(OK, "OK")
             self.send_header("Content-type", "text/plain")
@@ -170,37 +283,98 @@ class Handler(BaseHTTPRequestHandler):
             f.close()
 
         # Get last value
-        elif os.path.isfile(config.DATA_DIR + self.path + log_data.URL_LOG_EXT):
-            dev,res = self.path_to_device_resource(self.path + log_data.URL_LOG_EXT)
-            t, d, u = log_data.get_device_resource_lists(dev, res)
+        elif os.path.isfile(config.DATA_DIR + self.path + log_data.SEGMENT_EXT):
+            dev,res = self.path_to_device_resource(self.path)
+            last = log_data.get_latest(dev, res)
+            if last is None:
+                self.send_error(NOT_FOUND, "No value logged")
+                return
+            t, d, u, h = last
             s = "TIMESTAMP, DATA, UNIT\n"
-            s += str(t[-1]) + "," + str(d[-1]) + "," + str(u[-1])
+            s += (log_data.format_timestamp(t) + "," +
+                  log_data.format_value(d) + "," + u)
             self.send_response(OK, "OK")
             self.send_header("Content-type", "text/plain")
             self.send_header("Content-length", str(len(s)))
             self.end_headers()
             self.wfile.write(s.encode(encoding="UTF-8"))
 
-def http_server_thread():
-    global HTTP_SERVER_RUNNING
-    global HTTP_SERVER
-    HttpHandler = Handler
-    HttpHandler.protocol_version = "HTTP/1.1"
-    HttpHandler.timeout = 10
-    HTTP_SERVER = HTTPServer((config.SERVER_HOST, config.SERVER_PORT), HttpHandler)
+        else:
+            self.send_error(NOT_FOUND)
+
+def handle_datagram(sock, datagram, host, port, last_sequence):
+    decoded = log_data.decode_datagram(datagram)
+    if decoded is None:
+        print("Ignoring datagram from", host)
+        return
+    (sequence, ack_requested, measurements) = decoded
+    # A repeated sequence number is a retransmission after a lost ack
+    if last_sequence.get(host) != sequence:
+        last_sequence[host] = sequence
+        with STORE_LOCK:
+            log_data.write_batch(config.UDP_DEVICE, host, measurements)
+        if config.USE_I2C_MATRIX == True:
+            for (resource, data, units, timestamp) in measurements:
+                if "lux" in resource:
+                    i2c_led_matrix_8.update_scaled(int(data))
+    if ack_requested:
+        sock.sendto(log_data.encode_ack(sequence), (host, port))
+
+def udp_server_thread(sock):
+    last_sequence = {}
     while HTTP_SERVER_RUNNING == True:
-        HTTP_SERVER.handle_request()
+        try:
+            datagram, (host, port) = sock.recvfrom(log_data.UDP_MAX_DATAGRAM)
+        except socket.timeout:
+            continue
+        except OSError:
+            break
+        handle_datagram(sock, datagram, host, port, last_sequence)
+
+def udp_server_start():
+    global UDP_SERVER_THREAD
+    global UDP_SERVER_SOCKET
+    UDP_SERVER_SOCKET = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    UDP_SERVER_SOCKET.bind((config.SERVER_HOST, config.UDP_PORT))
+    UDP_SERVER_SOCKET.settimeout(1)
+    UDP_SERVER_THREAD = Thread(target = udp_server_thread,
+                               args = (UDP_SERVER_SOCKET,))
+    UDP_SERVER_THREAD.start()
+
+def udp_server_stop():
+    global UDP_SERVER_THREAD
+    global UDP_SERVER_SOCKET
+    if UDP_SERVER_THREAD is not None:
+        UDP_SERVER_THREAD.join()
+        UDP_SERVER_SOCKET.close()
+        UDP_SERVER_THREAD = None
+        UDP_SERVER_SOCKET = None
+
+
+def http_server_thread():
+    HTTP_SERVER.serve_forever()
 
 def http_server_start():
     global HTTP_SERVER_RUNNING
     global HTTP_SERVER_THREAD
+    global HTTP_SERVER
     print("Starting server...")
     if HTTP_SERVER_RUNNING is True:
         print("Already running!")
         return
+    log_data.import_csv_logs()
+    log_data.build_latest_index()
+    HttpHandler = Handler
+    HttpHandler.protocol_version = "HTTP/1.1"
+    HttpHandler.timeout = config.HTTP_IDLE_TIMEOUT
+    HTTP_SERVER = PooledHTTPServer((config.SERVER_HOST, config.SERVER_PORT),
+                                   HttpHandler, config.HTTP_WORKERS,
+                                   config.HTTP_MAX_PENDING)
     HTTP_SERVER_RUNNING = True
     HTTP_SERVER_THREAD = Thread(target = http_server_thread)
     HTTP_SERVER_THREAD.start()
+    if config.UDP_PORT is not None:
+        udp_server_start()
     if config.USE_I2C_MATRIX == True:
         i2c_led_matrix_8.matrix_start()
 
@@ -211,8 +385,10 @@ def http_server_stop():
     if HTTP_SERVER_THREAD is not None:
         print("Stopping server...")
         HTTP_SERVER_RUNNING = False
-        HTTP_SERVER.socket.close()
+        HTTP_SERVER.shutdown()
         HTTP_SERVER_THREAD.join()
+        HTTP_SERVER.server_close()
+        udp_server_stop()
         HTTP_SERVER = None
         HTTP_SERVER_THREAD = None
         if config.USE_I2C_MATRIX == True:
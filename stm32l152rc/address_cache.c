@@ -0,0 +1,139 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* The collector's resolved IPv4 address is cached in RTC backup registers so
+ * most wakes connect without a DNS lookup. The CC3000 doesn't report a DNS
+ * TTL, so entries expire ADDRESS_CACHE_S after they were resolved. A CRC of
+ * the URL is kept alongside so a changed SERVER_URL isn't served stale. */
+
+#include <string.h>
+#include "fyp.h"
+#include "socket.h"
+
+#define LOG_FILE                LOG_FILE_ADDRESS_CACHE
+
+#define ADDRESS_CACHE_S         (24 * 60 * 60)
+#define URL_WORDS               ((CLARITY_MAX_URL_LENGTH + 3) / 4)
+
+static uint32_t urlChecksum(const char * url)
+{
+    uint32_t words[URL_WORDS];
+
+    memset(words, 0, sizeof(words));
+    memcpy(words, url, strnlen(url, sizeof(words)));
+
+    return crcCalculate(words, URL_WORDS);
+}
+
+static uint32_t timeNow(void)
+{
+    clarityTimeDate now;
+
+    rtcRetrieve(&RTC_DRIVER, &now);
+
+    return rtcTimeDateToSeconds(&now);
+}
+
+/* Looks url up with the CC3000. ip is in host byte order. */
+clarityError addressResolve(const char * url, uint32_t * ip)
+{
+    unsigned long resolved = 0;
+    int rtn;
+
+    chMtxLock(&cc3000ApiMutex);
+    rtn = gethostbyname((char *)url, strlen(url), &resolved);
+    chMtxUnlock();
+
+    if (rtn < 0 || resolved == 0)
+    {
+        return CLARITY_ERROR_REMOTE_REQUEST;
+    }
+
+    *ip = resolved;
+    return CLARITY_SUCCESS;
+}
+
+/* Resolves url and refreshes the cache. On failure addr is left as the URL
+ * so the connection can still try its own lookup. */
+static void addressCacheFill(const char * url, clarityAddressInformation * addr)
+{
+    uint32_t ip;
+
+    addr->type = CLARITY_ADDRESS_URL;
+    strncpy(addr->addr.url, url, CLARITY_MAX_URL_LENGTH);
+
+    if (addressResolve(url, &ip) != CLARITY_SUCCESS)
+    {
+        PRINT_STR("Failed to resolve %s.", url);
+        rtcBackupWrite(BACKUP_REG_SERVER_IP_EXPIRY, 0);
+        return;
+    }
+
+    rtcBackupWrite(BACKUP_REG_SERVER_IP, ip);
+    rtcBackupWrite(BACKUP_REG_SERVER_URL_CRC, urlChecksum(url));
+    rtcBackupWrite(BACKUP_REG_SERVER_IP_EXPIRY, timeNow() + ADDRESS_CACHE_S);
+
+    addr->type = CLARITY_ADDRESS_IP;
+    addr->addr.ip = ip;
+}
+
+/* Sets addr to the cached address of url, resolving it first if there is no
+ * usable entry. The CC3000 must be up and the RTC set. */
+void addressCacheLookup(const char * url, clarityAddressInformation * addr)
+{
+    uint32_t expiry = rtcBackupRead(BACKUP_REG_SERVER_IP_EXPIRY);
+    uint32_t now = timeNow();
+
+    /* An expiry too far ahead means the clock has been stepped back. */
+    if (expiry == 0 || now >= expiry || expiry - now > ADDRESS_CACHE_S ||
+        rtcBackupRead(BACKUP_REG_SERVER_URL_CRC) != urlChecksum(url))
+    {
+        addressCacheFill(url, addr);
+        return;
+    }
+
+    addr->type = CLARITY_ADDRESS_IP;
+    addr->addr.ip = rtcBackupRead(BACKUP_REG_SERVER_IP);
+}
+
+/* Called after a request to addr failed. If addr came from the cache it is
+ * resolved again, returning true if that gave a different address to retry
+ * the request with. */
+bool addressCacheRefresh(const char * url, clarityAddressInformation * addr)
+{
+    uint32_t failedIp;
+
+    if (addr->type != CLARITY_ADDRESS_IP)
+    {
+        return false;
+    }
+
+    failedIp = addr->addr.ip;
+    addressCacheFill(url, addr);
+
+    return addr->type == CLARITY_ADDRESS_IP && addr->addr.ip != failedIp;
+}
+
@@ -0,0 +1,107 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include "crc.h"
+
+#if defined(__arm__)
+#include "ch.h"
+#include "hal.h"
+
+uint32_t crcCalculate(const uint32_t * data, uint32_t words)
+{
+    uint32_t crc;
+
+    /* The peripheral's state is shared, calculations must not interleave. */
+    chSysLock();
+
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+    CRC->CR = CRC_CR_RESET;
+
+    while (words > 0)
+    {
+        CRC->DR = *data;
+        data++;
+        words--;
+    }
+
+    crc = CRC->DR;
+
+    chSysUnlock();
+
+    return crc;
+}
+
+#else
+
+#define CRC_POLYNOMIAL  0x04C11DB7
+
+static uint32_t crcTable[256];
+static int crcTableBuilt = 0;
+
+static void crcBuildTable(void)
+{
+    uint32_t i;
+    uint32_t bit;
+    uint32_t crc;
+
+    for (i = 0; i < 256; i++)
+    {
+        crc = i << 24;
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ CRC_POLYNOMIAL : crc << 1;
+        }
+
+        crcTable[i] = crc;
+    }
+
+    crcTableBuilt = 1;
+}
+
+uint32_t crcCalculate(const uint32_t * data, uint32_t words)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (crcTableBuilt == 0)
+    {
+        crcBuildTable();
+    }
+
+    while (words > 0)
+    {
+        crc ^= *data;
+        crc = (crc << 8) ^ crcTable[crc >> 24];
+        crc = (crc << 8) ^ crcTable[crc >> 24];
+        crc = (crc << 8) ^ crcTable[crc >> 24];
+        crc = (crc << 8) ^ crcTable[crc >> 24];
+        data++;
+        words--;
+    }
+
+    return crc;
+}
+
+#endif
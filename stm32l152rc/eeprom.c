@@ -28,11 +28,43 @@
 #include <string.h>
 #include "fyp.h"
 
+#define LOG_FILE                LOG_FILE_EEPROM
+
 #define EEPROM_BASE         0x08080000
 #define EEPROM_LAST         0x08081FFF
 #define EEPROM_SIZE         (EEPROM_LAST - EEPROM_BASE + 1)
 
-#define STORE_ADDR_EEPROM   ((uint32_t *)EEPROM_BASE)
+/* The lower half of the EEPROM is an append only log of typed records. An
+ * update writes one new record into the next free slot, the newest valid
+ * record of each type (by sequence number) is the current value. Slots
+ * holding the current value of any type are skipped when writing, everything
+ * else is reused in turn so wear is spread across the whole log. */
+#define RECORD_LOG_BASE         ((eepromRecord *)EEPROM_BASE)
+#define RECORD_LOG_SLOTS        ((EEPROM_SIZE / 2) / sizeof(eepromRecord))
+#define RECORD_PAYLOAD_WORDS    6
+#define RECORD_NONE             (-1)
+
+/* Header: type (4 bits) | payload words (4 bits) | sequence number (24 bits) */
+#define RECORD_SEQUENCE_MASK    0x00FFFFFF
+#define RECORD_HEADER(TYPE, WORDS, SEQ)                                     \
+        (((uint32_t)(TYPE) << 28) | ((uint32_t)(WORDS) << 24) |             \
+         ((SEQ) & RECORD_SEQUENCE_MASK))
+#define RECORD_TYPE(HEADER)     ((HEADER) >> 28)
+#define RECORD_WORDS(HEADER)    (((HEADER) >> 24) & 0xF)
+#define RECORD_SEQUENCE(HEADER) ((HEADER) & RECORD_SEQUENCE_MASK)
+
+/* The upper half of the EEPROM holds a ring of samples waiting to be
+ * uploaded. Its oldest index and count live in an RTC backup register so
+ * appending a sample costs only the record write. Once the log is full that
+ * write replaces the oldest sample before the register moves past it, so each
+ * record carries a CRC to catch one torn by a power loss. */
+#define SAMPLE_LOG_BASE     (EEPROM_BASE + EEPROM_SIZE / 2)
+#define SAMPLE_LOG_RECORDS  ((EEPROM_SIZE / 2) / sizeof(sampleLogRecord))
+#define SAMPLE_LOG_INVALID  ((int32_t)0x80000000)
+
+#define SAMPLE_LOG_OLDEST(REG)          ((REG) & 0xFFFF)
+#define SAMPLE_LOG_COUNT(REG)           ((REG) >> 16)
+#define SAMPLE_LOG_REG(OLDEST, COUNT)   (((COUNT) << 16) | (OLDEST))
 
 #define compile_time_assert(X)                                              \
     extern int (*compile_assert(void))[sizeof(struct {                      \
@@ -44,12 +76,33 @@ typedef struct {
     uint32_t shutdowns;
 } eepromData;
 
+/* Only header, checksum and the used payload words are written. */
 typedef struct {
-    eepromData data;
-    uint32_t checksum;
-} eepromStore;
+    uint32_t header;
+    uint32_t checksum;      /* Covers header and used payload */
+    uint32_t payload[RECORD_PAYLOAD_WORDS];
+} eepromRecord;
+
+compile_time_assert(sizeof(eepromRecord) == 32); /* We don't want any padding */
+compile_time_assert(EEPROM_RECORD_TYPES <= 16);
+compile_time_assert(sizeof(eepromData) <= RECORD_PAYLOAD_WORDS * sizeof(uint32_t));
+
+static bool recordLogMounted = false;
+static int16_t newestSlot[EEPROM_RECORD_TYPES];
+static int16_t lastSlot;
+static uint32_t lastSequence;
+
+typedef struct {
+    uint32_t time;          /* Seconds since 2000 */
+    int32_t lux;            /* SAMPLE_LOG_INVALID if not valid */
+    int32_t temperature;
+    int32_t pressure;
+    uint32_t checksum;      /* CRC of the words above */
+} sampleLogRecord;
+
+#define SAMPLE_LOG_CHECKSUM_WORDS   4
 
-compile_time_assert(sizeof(eepromStore) == 16); /* We don't want any padding */
+compile_time_assert(sizeof(sampleLogRecord) == 20);
 
 /* As per: 4.1.1 Unlocking the Data EEPROM block and the FLASH_PECR register in
  * PM0062 Programming Manual */
@@ -76,31 +129,41 @@ static eepromError eepromLock(void)
     return EEPROM_ERROR_OK;
 }
 
-/* As per: 4.3.6 Data EEPROM Word Write in PM0062 Programming Manual */
+/* As per: 4.3.6 Data EEPROM Word Write in PM0062 Programming Manual.
+ * The system lock is only held for one word at a time. */
 static eepromError eepromWriteWords(uint32_t * address, const uint32_t * data,  uint32_t size)
 {
     eepromError rtn;
 
-    chSysLock();
     size /= sizeof(uint32_t);
 
+    chSysLock();
+
     if ((rtn = eepromUnlock()) != EEPROM_ERROR_OK)
     {
+        chSysUnlock();
         return rtn;
     }
 
     FLASH->PECR |= FLASH_PECR_FTDW; 
 
+    chSysUnlock();
+
     while (size > 0)
     {
+        chSysLock();
         *address = *data;
+        chSysUnlock();
+
+        while ((FLASH->SR & FLASH_SR_BSY) != 0);
+
         address++;
         data++;
         size--;
     }
 
+    chSysLock();
     eepromLock();
-
     chSysUnlock();
 
     return EEPROM_ERROR_OK;
@@ -121,36 +184,37 @@ static eepromError eepromReadWords(const uint32_t * address, uint32_t * data, ui
     return EEPROM_ERROR_OK;
 }
 
-static int32_t generateChecksum(const void * data, uint32_t bytes)
+/* The checksum is the CRC of the header followed by the used payload. */
+static uint32_t recordChecksum(const eepromRecord * record)
 {
-    uint32_t checksum = 0;
-    uint8_t index = 0;
-    uint8_t * pChk = (uint8_t *)&checksum;
-    const uint8_t * pD = (uint8_t *)data;
+    uint32_t words[1 + RECORD_PAYLOAD_WORDS];
+    uint32_t payloadWords = RECORD_WORDS(record->header);
 
-    while(bytes > 0)
+    if (payloadWords > RECORD_PAYLOAD_WORDS)
     {
-# if 0
-        PRINT("xor: %u and %u\n", *(pChk + index % 4), *(pD + index));
-#endif
-        *(pChk + index % 4) ^= *(pD + index);
-
-        index++;
-        bytes--;
+        payloadWords = RECORD_PAYLOAD_WORDS;
     }
 
-    return checksum;
+    words[0] = record->header;
+    memcpy(&words[1], record->payload, payloadWords * sizeof(uint32_t));
+
+    return crcCalculate(words, 1 + payloadWords);
 }
 
-static eepromError checksumUpdate(eepromStore * store)
+static eepromError checksumUpdate(eepromRecord * record)
 {
-    store->checksum = generateChecksum(&(store->data), sizeof(store->data));
+    record->checksum = recordChecksum(record);
     return EEPROM_ERROR_OK;
 }
 
-static eepromError checksumOk(eepromStore * store)
+static eepromError checksumOk(const eepromRecord * record)
 {
-    if (generateChecksum(store, sizeof(*store)) == 0)
+    if (RECORD_WORDS(record->header) > RECORD_PAYLOAD_WORDS)
+    {
+        return EEPROM_ERROR_FALSE;
+    }
+
+    if (record->checksum == recordChecksum(record))
     {
         return EEPROM_ERROR_TRUE;
     }
@@ -158,77 +222,240 @@ static eepromError checksumOk(eepromStore * store)
     return EEPROM_ERROR_FALSE;
 }
 
+/* Sequence numbers wrap at 24 bits */
+static bool sequenceNewer(uint32_t a, uint32_t b)
+{
+    return (int32_t)((a - b) << 8) > 0;
+}
 
-#if 0
-bool chibios_test_eeprom(void)
+static bool slotInUse(int16_t slot)
 {
-    eepromStore tempStore;
-    eepromStore tempStoreRead;
-    uint32_t chksum;
-    bool b;
+    uint32_t type;
 
-    memset(&tempStore,0,sizeof(tempStore));
-    memset(&tempStoreRead,0,sizeof(tempStore));
+    for (type = 0; type < EEPROM_RECORD_TYPES; type++)
+    {
+        if (newestSlot[type] == slot)
+        {
+            return true;
+        }
+    }
 
-    tempStore.data.lastShutdownError = 0x55;
-    tempStore.data.unresponsiveShutdowns = 0x53;
+    return false;
+}
 
-    chksum = generateChecksum(&tempStore, sizeof(tempStore));
+/* Scans the log for the newest valid record of each type and the most
+ * recently written slot. */
+static eepromError recordLogMount(void)
+{
+    eepromRecord record;
+    uint32_t type;
+    uint32_t sequence;
+    int16_t slot;
 
-    PRINT("generated checksum: %x\n", chksum);
-    checksumUpdate(&tempStore);
-    b = checksumOk(&tempStore);
-    PRINT("generated ok?: %d\n", b);
+    for (type = 0; type < EEPROM_RECORD_TYPES; type++)
+    {
+        newestSlot[type] = RECORD_NONE;
+    }
 
-    /* Write stucture to eeprom */
-    eepromWriteWords(STORE_ADDR_EEPROM, (uint32_t*)&tempStore, sizeof(tempStore));
+    lastSlot = RECORD_NONE;
+    lastSequence = 0;
 
-    /* Read Structure from eeprom */
-    eepromReadWords(STORE_ADDR_EEPROM, (uint32_t*)&tempStoreRead, sizeof(tempStoreRead));
- 
-    b = checksumOk(&tempStoreRead);
-    PRINT("Read ok?: %d\n", b);
+    for (slot = 0; slot < (int16_t)RECORD_LOG_SLOTS; slot++)
+    {
+        eepromReadWords((uint32_t *)(RECORD_LOG_BASE + slot), 
+                        (uint32_t *)&record, sizeof(record));
+
+        type = RECORD_TYPE(record.header);
+        sequence = RECORD_SEQUENCE(record.header);
+
+        if (type == 0 || type >= EEPROM_RECORD_TYPES ||
+            checksumOk(&record) != EEPROM_ERROR_TRUE)
+        {
+            continue;
+        }
+
+        if (newestSlot[type] == RECORD_NONE || 
+            sequenceNewer(sequence, 
+                RECORD_SEQUENCE(RECORD_LOG_BASE[newestSlot[type]].header)))
+        {
+            newestSlot[type] = slot;
+        }
+
+        if (lastSlot == RECORD_NONE || sequenceNewer(sequence, lastSequence))
+        {
+            lastSlot = slot;
+            lastSequence = sequence;
+        }
+    }
+
+    recordLogMounted = true;
 
-    if (memcmp(&tempStore, &tempStoreRead, sizeof(tempStore)) == 0)
+    return EEPROM_ERROR_OK;
+}
+
+/* Copies the current value of a record type into data. Payload beyond what
+ * was last written reads as zero. */
+eepromError eepromRecordRead(eepromRecordType type, void * data, uint32_t size)
+{
+    eepromRecord record;
+    uint32_t stored;
+
+    if (type == 0 || type >= EEPROM_RECORD_TYPES || 
+        size > sizeof(record.payload))
     {
-        PRINT("memcmp ok", NULL);
+        return EEPROM_ERROR_MISC;
     }
-    else
+
+    if (recordLogMounted == false)
+    {
+        recordLogMount();
+    }
+
+    if (newestSlot[type] == RECORD_NONE)
+    {
+        return EEPROM_ERROR_EMPTY;
+    }
+
+    eepromReadWords((uint32_t *)(RECORD_LOG_BASE + newestSlot[type]),
+                    (uint32_t *)&record, sizeof(record));
+
+    /* Re-check in case the slot changed under us */
+    if (checksumOk(&record) != EEPROM_ERROR_TRUE)
+    {
+        return EEPROM_ERROR_CORRUPT;
+    }
+
+    stored = RECORD_WORDS(record.header) * sizeof(uint32_t);
+
+    memset(data, 0, size);
+    memcpy(data, record.payload, stored < size ? stored : size);
+
+    return EEPROM_ERROR_OK;
+}
+
+/* Appends a new record holding data as the current value of type. */
+eepromError eepromRecordWrite(eepromRecordType type, const void * data, 
+                              uint32_t size)
+{
+    eepromRecord record;
+    uint32_t words = (size + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    int16_t slot;
+    eepromError rtn;
+
+    if (type == 0 || type >= EEPROM_RECORD_TYPES || 
+        words > RECORD_PAYLOAD_WORDS)
+    {
+        return EEPROM_ERROR_MISC;
+    }
+
+    if (recordLogMounted == false)
+    {
+        recordLogMount();
+    }
+
+    slot = lastSlot;
+
+    do
+    {
+        slot = (slot + 1) % RECORD_LOG_SLOTS;
+    } while (slotInUse(slot) == true);
+
+    memset(&record, 0, sizeof(record));
+    memcpy(record.payload, data, size);
+    record.header = RECORD_HEADER(type, words, lastSequence + 1);
+    checksumUpdate(&record);
+
+    /* Header last, so a partially written record fails its checksum */
+    if ((rtn = eepromWriteWords(&RECORD_LOG_BASE[slot].checksum,
+                                &record.checksum,
+                                (words + 1) * sizeof(uint32_t))) 
+            != EEPROM_ERROR_OK)
+    {
+        return rtn;
+    }
+
+    if ((rtn = eepromWriteWords(&RECORD_LOG_BASE[slot].header,
+                                &record.header, sizeof(record.header)))
+            != EEPROM_ERROR_OK)
     {
-        PRINT("memcmp NOT ok", NULL);
+        return rtn;
     }
 
-    b = checksumOk(&tempStoreRead);
+    newestSlot[type] = slot;
+    lastSlot = slot;
+    lastSequence = RECORD_SEQUENCE(record.header);
+
+    return EEPROM_ERROR_OK;
+}
+
+#if 0
+bool chibios_test_eeprom(void)
+{
+    eepromData tempData;
+    eepromData tempDataRead;
+    eepromError rtn;
+
+    memset(&tempData,0,sizeof(tempData));
+    memset(&tempDataRead,0,sizeof(tempDataRead));
+
+    tempData.lastShutdownError = 0x55;
+    tempData.unresponsiveShutdowns = 0x53;
+
+    rtn = eepromRecordWrite(EEPROM_RECORD_STORE, &tempData, sizeof(tempData));
+    PRINT("Write ok?: %d\n", rtn);
+
+    /* Force a rescan of the log, as after a reset */
+    recordLogMounted = false;
 
-    PRINT("generated ok?: %d\n", b);
+    rtn = eepromRecordRead(EEPROM_RECORD_STORE, &tempDataRead, 
+                           sizeof(tempDataRead));
+    PRINT("Read ok?: %d\n", rtn);
+
+    if (memcmp(&tempData, &tempDataRead, sizeof(tempData)) == 0)
+    {
+        PRINT("memcmp ok");
+    }
+    else
+    {
+        PRINT("memcmp NOT ok");
+    }
 
     return false;
 }
 #endif
 
-eepromError eepromStoreGet(eepromStore * store)
+/* A log that has never held the store reads as a zeroed store, as the
+ * blank EEPROM did before the log. */
+static eepromError eepromStoreGet(eepromData * data)
 {
-    return eepromReadWords(STORE_ADDR_EEPROM, (uint32_t*)store, sizeof(*store));
+    eepromError rtn;
+
+    if ((rtn = eepromRecordRead(EEPROM_RECORD_STORE, data, sizeof(*data)))
+            == EEPROM_ERROR_EMPTY)
+    {
+        memset(data, 0, sizeof(*data));
+        return EEPROM_ERROR_OK;
+    }
+
+    return rtn;
 }
 
-eepromError eepromStorePut(const eepromStore * store)
+static eepromError eepromStorePut(const eepromData * data)
 {
-    return eepromWriteWords(STORE_ADDR_EEPROM, (const uint32_t*)store, sizeof(*store));
+    return eepromRecordWrite(EEPROM_RECORD_STORE, data, sizeof(*data));
 }
 
 
 eepromError eepromWasLastShutdownOk(void)
 {
-    eepromStore data;
-    
-    eepromStoreGet(&data);
+    eepromData data;
     
-    if (checksumOk(&data) != EEPROM_ERROR_TRUE)
+    if (eepromStoreGet(&data) != EEPROM_ERROR_OK)
     {
         return EEPROM_ERROR_CORRUPT;
     }
 
-    if (data.data.lastShutdownError == 0)
+    if (data.lastShutdownError == 0)
     {
         return EEPROM_ERROR_TRUE;
     }
@@ -238,26 +465,16 @@ eepromError eepromWasLastShutdownOk(void)
 
 eepromError eepromWipeStore(void)
 {
-    eepromStore data;
-    eepromError rtn;
+    eepromData data;
     
     memset(&data, 0, sizeof(data));
 
-    if ((rtn = checksumUpdate(&data)) != EEPROM_ERROR_OK)
-    {
-        return rtn;
-    }
-    else if ((rtn = eepromStorePut(&data)) != EEPROM_ERROR_OK)
-    {
-        return rtn;
-    }
-
-    return EEPROM_ERROR_OK;
+    return eepromStorePut(&data);
 }
 
 eepromError eepromAcknowledgeLastShutdownError(void)
 {
-    eepromStore data;
+    eepromData data;
     eepromError rtn;
 
     if ((rtn = eepromStoreGet(&data)) != EEPROM_ERROR_OK)
@@ -265,91 +482,178 @@ eepromError eepromAcknowledgeLastShutdownError(void)
         return rtn;
     }
 
-    data.data.lastShutdownError = 0;
+    data.lastShutdownError = 0;
 
-    if ((rtn = checksumUpdate(&data)) != EEPROM_ERROR_OK)
-    {
-        return rtn;
-    }
-    else if ((rtn = eepromStorePut(&data)) != EEPROM_ERROR_OK)
-    {
-        return rtn;
-    }
-
-    return EEPROM_ERROR_OK;
+    return eepromStorePut(&data);
 }
 
 eepromError eepromRecordUnresponsiveShutdown(void)
 {
-    eepromStore data;
-    eepromError rtn;
+    eepromData data;
     
-    if ((rtn = eepromStoreGet(&data)) != EEPROM_ERROR_OK)
+    if (eepromStoreGet(&data) != EEPROM_ERROR_OK)
     {
-        return rtn;
+        memset(&data, 0, sizeof(data));
     }
+    
+    data.lastShutdownError = 1;
+    data.unresponsiveShutdowns++;
+    
+    return eepromStorePut(&data);
+}
 
-    if (checksumOk(&data) != EEPROM_ERROR_TRUE)
+#if 0
+eepromError eepromRecordShutdown(void)
+{
+    eepromData data;
+    
+    if (eepromStoreGet(&data) != EEPROM_ERROR_OK)
     {
         memset(&data, 0, sizeof(data));
+        PRINT_ERROR();
     }
     
-    data.data.lastShutdownError = 1;
-    data.data.unresponsiveShutdowns++;
+    data.shutdowns++;
     
-    if ((rtn = checksumUpdate(&data)) != EEPROM_ERROR_OK)
+    PRINT("Shutdowns now :%u", data.shutdowns);
+
+    return eepromStorePut(&data);
+}
+
+#endif
+
+
+static sampleLogRecord * sampleLogAddress(uint32_t index)
+{
+    return (sampleLogRecord *)SAMPLE_LOG_BASE + (index % SAMPLE_LOG_RECORDS);
+}
+
+static void sampleLogState(uint32_t * oldest, uint32_t * count)
+{
+    uint32_t reg = rtcBackupRead(BACKUP_REG_SAMPLE_LOG);
+
+    *oldest = SAMPLE_LOG_OLDEST(reg);
+    *count = SAMPLE_LOG_COUNT(reg);
+
+    if (*oldest >= SAMPLE_LOG_RECORDS || *count > SAMPLE_LOG_RECORDS)
     {
-        return rtn;
+        *oldest = 0;
+        *count = 0;
     }
-    else if ((rtn = eepromStorePut(&data)) != EEPROM_ERROR_OK)
+}
+
+/* When the log is full the oldest sample is overwritten. */
+eepromError eepromSampleLogAppend(const sensorSample * sample)
+{
+    sampleLogRecord record;
+    uint32_t oldest;
+    uint32_t count;
+    eepromError rtn;
+
+    sampleLogState(&oldest, &count);
+
+    record.time = rtcTimeDateToSeconds(&sample->timestamp);
+    record.lux = sample->luxValid ? sample->lux : SAMPLE_LOG_INVALID;
+    record.temperature = sample->barometerValid ? sample->temperature :
+                                                  SAMPLE_LOG_INVALID;
+    record.pressure = sample->barometerValid ? sample->pressure :
+                                               SAMPLE_LOG_INVALID;
+    record.checksum = crcCalculate((uint32_t *)&record,
+                                   SAMPLE_LOG_CHECKSUM_WORDS);
+
+    if ((rtn = eepromWriteWords((uint32_t *)sampleLogAddress(oldest + count),
+                                (uint32_t *)&record, sizeof(record))) 
+            != EEPROM_ERROR_OK)
     {
         return rtn;
     }
-    else 
+
+    if (count == SAMPLE_LOG_RECORDS)
     {
-        return EEPROM_ERROR_OK;
+        oldest = (oldest + 1) % SAMPLE_LOG_RECORDS;
+    }
+    else
+    {
+        count++;
     }
 
-    return EEPROM_ERROR_MISC;
+    rtcBackupWrite(BACKUP_REG_SAMPLE_LOG, SAMPLE_LOG_REG(oldest, count));
+
+    return EEPROM_ERROR_OK;
 }
 
-#if 0
-eepromError eepromRecordShutdown(void)
+uint32_t eepromSampleLogCount(void)
+{
+    uint32_t oldest;
+    uint32_t count;
+
+    sampleLogState(&oldest, &count);
+
+    return count;
+}
+
+uint32_t eepromSampleLogCapacity(void)
 {
-    eepromStore data;
+    return SAMPLE_LOG_RECORDS;
+}
+
+/* index 0 is the oldest sample held. Returns EEPROM_ERROR_CORRUPT if its
+ * record doesn't match its checksum. */
+eepromError eepromSampleLogRead(uint32_t index, sensorSample * sample)
+{
+    sampleLogRecord record;
+    uint32_t oldest;
+    uint32_t count;
     eepromError rtn;
-    
-    if ((rtn = eepromStoreGet(&data)) != EEPROM_ERROR_OK)
-    {
-        return rtn;
-    }
 
-    if (checksumOk(&data) != EEPROM_ERROR_TRUE)
+    sampleLogState(&oldest, &count);
+
+    if (index >= count)
     {
-        memset(&data, 0, sizeof(data));
-        PRINT_ERROR();
+        return EEPROM_ERROR_MISC;
     }
-    
-    data.data.shutdowns++;
-    
-    PRINT("Shutdowns now :%u", data.data.shutdowns);
-    PRINT("Shutdowns now :%u", data.data.shutdowns);
-    PRINT("Shutdowns now :%u", data.data.shutdowns);
 
-    if ((rtn = checksumUpdate(&data)) != EEPROM_ERROR_OK)
+    if ((rtn = eepromReadWords((uint32_t *)sampleLogAddress(oldest + index),
+                               (uint32_t *)&record, sizeof(record)))
+            != EEPROM_ERROR_OK)
     {
         return rtn;
     }
-    else if ((rtn = eepromStorePut(&data)) != EEPROM_ERROR_OK)
+
+    if (crcCalculate((uint32_t *)&record, SAMPLE_LOG_CHECKSUM_WORDS) !=
+            record.checksum)
     {
-        return rtn;
+        return EEPROM_ERROR_CORRUPT;
     }
-    else 
+
+    memset(sample, 0, sizeof(*sample));
+    rtcSecondsToTimeDate(record.time, &sample->timestamp);
+    sample->luxValid = record.lux != SAMPLE_LOG_INVALID;
+    sample->lux = record.lux;
+    sample->barometerValid = record.temperature != SAMPLE_LOG_INVALID;
+    sample->temperature = record.temperature;
+    sample->pressure = record.pressure;
+
+    return EEPROM_ERROR_OK;
+}
+
+/* Drops the oldest samples, once they have been uploaded. */
+eepromError eepromSampleLogDiscard(uint32_t samples)
+{
+    uint32_t oldest;
+    uint32_t count;
+
+    sampleLogState(&oldest, &count);
+
+    if (samples > count)
     {
-        return EEPROM_ERROR_OK;
+        samples = count;
     }
 
-    return EEPROM_ERROR_MISC;
-}
+    oldest = (oldest + samples) % SAMPLE_LOG_RECORDS;
+    count -= samples;
 
-#endif
+    rtcBackupWrite(BACKUP_REG_SAMPLE_LOG, SAMPLE_LOG_REG(oldest, count));
+
+    return EEPROM_ERROR_OK;
+}
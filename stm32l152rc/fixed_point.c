@@ -0,0 +1,113 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <stddef.h>
+#include "fixed_point.h"
+
+typedef struct {
+    const char * suffix;
+    uint8_t decimals;
+    uint32_t scale;             /* 10 ^ decimals */
+} fixedPointUnit;
+
+static const fixedPointUnit units[] = {
+    [UNIT_CODE_LUX]         = {" lx",  0, 1},
+    [UNIT_CODE_KELVIN_X100] = {" K",   2, 100},
+    [UNIT_CODE_KPA_X100]    = {" kPa", 2, 100},
+};
+
+#define UNIT_COUNT  (sizeof(units) / sizeof(units[0]))
+
+/* Writes value / scale with the unit's decimal places and suffix, e.g.
+ * 29315 as UNIT_CODE_KELVIN_X100 becomes "293.15 K".
+ * Returns the string length, or -1 if buf is too small or the unit unknown. */
+int32_t fixedPointFormat(char * buf, uint32_t size, int32_t value, 
+                         unitCode unit)
+{
+    const fixedPointUnit * u;
+    char digits[12];
+    uint8_t digitCount = 0;
+    uint32_t magnitude;
+    uint32_t len = 0;
+    const char * suffix;
+
+    if ((uint32_t)unit >= UNIT_COUNT || units[unit].suffix == NULL)
+    {
+        return -1;
+    }
+
+    u = &units[unit];
+
+    magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+
+    /* Least significant digit first, always at least one integer digit */
+    do
+    {
+        digits[digitCount++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0 || digitCount <= u->decimals);
+
+    if (value < 0)
+    {
+        if (len + 1 >= size)
+        {
+            return -1;
+        }
+        buf[len++] = '-';
+    }
+
+    while (digitCount > 0)
+    {
+        if (len + 1 >= size)
+        {
+            return -1;
+        }
+
+        if (digitCount == u->decimals)
+        {
+            buf[len++] = '.';
+
+            if (len + 1 >= size)
+            {
+                return -1;
+            }
+        }
+
+        buf[len++] = digits[--digitCount];
+    }
+
+    for (suffix = u->suffix; *suffix != 0; suffix++)
+    {
+        if (len + 1 >= size)
+        {
+            return -1;
+        }
+        buf[len++] = *suffix;
+    }
+
+    buf[len] = 0;
+
+    return len;
+}
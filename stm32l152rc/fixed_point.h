@@ -0,0 +1,50 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Integer only formatting of scaled sensor values. Kept free of ChibiOS
+ * dependencies so it can also be built on the host. */
+
+#ifndef __FIXED_POINT_H__
+#define __FIXED_POINT_H__
+
+#include <stdint.h>
+
+typedef enum {
+    UNIT_CODE_LUX           = 1,    /* lx */
+    UNIT_CODE_KELVIN_X100   = 2,    /* K * 100 */
+    UNIT_CODE_KPA_X100      = 3     /* kPa * 100 */
+} unitCode;
+
+/* Longest string fixedPointFormat() produces for a value of the unit,
+ * including the NULL. */
+#define FIXED_POINT_LUX_SIZE        9   /* "65535 lx" */
+#define FIXED_POINT_KELVIN_SIZE     9   /* "xxx.xx K" */
+#define FIXED_POINT_KPA_SIZE        11  /* "xxx.xx kPa" */
+
+int32_t fixedPointFormat(char * buf, uint32_t size, int32_t value, 
+                         unitCode unit);
+
+#endif /*__FIXED_POINT_H__*/
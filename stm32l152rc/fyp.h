@@ -33,6 +33,8 @@
 #include "chprintf.h"
 #endif
 #include "clarity_api.h"
+#include "fixed_point.h"
+#include "crc.h"
 
 /* Serial  */
 #define SERIAL_PORT             GPIOA
@@ -63,22 +65,146 @@
 #define CC3000_EXT_DRIVER       EXTD1
 
 
-extern Mutex printMtx;
+extern Mutex cc3000ApiMutex;
+
+/* Deferred logging, see log.c. A file that logs defines LOG_FILE as its
+ * logFile, and a message is identified by that and the line it's on. PRINT()
+ * takes integer arguments only, PRINT_STR() a single string. The format
+ * strings are only read by utils/log_decode.py. */
+typedef enum {
+    LOG_FILE_NONE           = 0,    /* Ids which aren't PRINT()s */
+    LOG_FILE_MAIN           = 1,
+    LOG_FILE_ADDRESS_CACHE  = 2,
+    LOG_FILE_EEPROM         = 3,
+    LOG_FILE_HTTP_SENSORS   = 4,
+    LOG_FILE_POLICY         = 5,
+    LOG_FILE_RTC_HANDLING   = 6,
+    LOG_FILE_SENSORS        = 7,
+    LOG_FILE_STATS          = 8,
+    LOG_FILE_UDP_UPLOAD     = 9
+} logFile;
+
+#define LOG_ID_TEXT             1       /* Text from debugPrint() */
+#define LOG_ID_DROPPED          2       /* Records lost to a full ring */
+#define LOG_STRING_MAX          128
+
+#define LOG_ID()                (((uint32_t)LOG_FILE << 16) | __LINE__)
+#define LOG_ARGS(...)           ((const uint32_t[]){0, ##__VA_ARGS__} + 1)
+#define LOG_ARGC(...)                                                       \
+        (sizeof((const uint32_t[]){0, ##__VA_ARGS__}) / sizeof(uint32_t) - 1)
 
-void debugPrint(const char * fmt, ...);
 #define PRINT(fmt, ...)                                                     \
-        debugPrint("(%s:%d) " fmt "\n\r", __FILE__, __LINE__, __VA_ARGS__)  
+        logWrite(LOG_ID(), LOG_ARGS(__VA_ARGS__), LOG_ARGC(__VA_ARGS__))
+#define PRINT_STR(fmt, str)     logWriteString(LOG_ID(), (str))
+#define PRINT_ERROR()           logWrite(LOG_ID(), NULL, 0)
 
-#define PRINT_ERROR()                                                       \
-        debugPrint("(%s:%d) ERROR\n\r", __FILE__, __LINE__)
+void logStart(void);
+void logStop(void);
+void logWrite(uint32_t id, const uint32_t * args, uint32_t argc);
+void logWriteString(uint32_t id, const char * str);
+void debugPrint(const char * fmt, ...);
+int32_t formatTextV(char * buf, uint32_t size, const char * fmt, va_list ap);
+int32_t formatText(char * buf, uint32_t size, const char * fmt, ...);
+
+/* RTC backup register allocation */
+typedef enum {
+    BACKUP_REG_WAKE_COUNT   = 0,    /* Wakes since the last upload */
+    BACKUP_REG_SAMPLE_LOG   = 1,    /* Sample log oldest index and count */
+    BACKUP_REG_TIMING_UPLOAD= 2,    /* Radio wakes since timing was uploaded */
+    BACKUP_REG_TIMING       = 3,    /* Two per timingPhase, up to 20 */
+    BACKUP_REG_UDP_SEQUENCE = 21,   /* Last UDP datagram sequence number */
+    BACKUP_REG_SERVER_IP    = 22,   /* Cached collector address */
+    BACKUP_REG_SERVER_IP_EXPIRY = 23,   /* Seconds since 2000, 0 if none */
+    BACKUP_REG_SERVER_URL_CRC = 24, /* CRC of the URL that was resolved */
+    BACKUP_REG_SCHEDULE_SLEEP = 25, /* Seconds the wakeup timer was set for */
+    BACKUP_REG_SCHEDULE     = 26,   /* One per scheduleId, up to 29 */
+    BACKUP_REG_SCHEDULE_AWAKE_MS = 30,  /* Awake not yet taken off, < 1 s */
+    BACKUP_REG_COUNT        = 32    /* Registers available (Cat.3 device) */
+} rtcBackupRegister;
 
 int32_t updateRtcWithSntp(void);
 void rtcRetrieve(RTCDriver * driver, clarityTimeDate * info);
+void rtcClockLoad(void);
+bool rtcSyncDue(uint32_t maxErrorS);
 void rtcStore(RTCDriver * driver, const clarityTimeDate * info);
 int32_t configureRtcAlarmAndStandby(RTCDriver * rtcDriver, uint32_t seconds);
+#define RTC_WAKEUP_MAX_S        65536
+void configureRtcWakeupAndStandby(uint32_t seconds);
+uint32_t rtcTimeDateToSeconds(const clarityTimeDate * info);
+void rtcSecondsToTimeDate(uint32_t seconds, clarityTimeDate * info);
+uint32_t rtcBackupRead(rtcBackupRegister reg);
+void rtcBackupWrite(rtcBackupRegister reg, uint32_t value);
+
+/* Periodic schedules run from the RTC wakeup timer, see scheduler.c. At most
+ * four. */
+typedef enum {
+    SCHEDULE_SAMPLE         = 0,
+    SCHEDULE_UPLOAD         = 1,
+    SCHEDULES                       /* Must be last */
+} scheduleId;
+
+#define SCHEDULE_FIRED(mask, id)    (((mask) & (1 << (id))) != 0)
+
+uint32_t schedulerWake(const uint32_t * periods);
+void schedulerStandby(void);
+
+/* Wake cycle phases timed with the DWT cycle counter */
+typedef enum {
+    TIMING_PHASE_HAL_INIT       = 0,
+    TIMING_PHASE_CC3000_INIT    = 1,
+    TIMING_PHASE_ASSOCIATE      = 2,
+    TIMING_PHASE_SNTP           = 3,
+    TIMING_PHASE_POST_ERROR     = 4,
+    TIMING_PHASE_POST_TIMING    = 5,
+    TIMING_PHASE_POST_SAMPLES   = 6,
+    TIMING_PHASE_SHUTDOWN       = 7,
+    TIMING_PHASE_STANDBY        = 8,
+    TIMING_PHASES                   /* Must be last */
+} timingPhase;
+
+/* Longest timingFormat() output, every phase as "name_mean time us\n",
+ * "name_min time us\n" and "name_max time us\n" with the longest name and 10
+ * digit times. */
+#define TIMING_NAME_MAX         12  /* "post_samples" */
+#define TIMING_FORMAT_MAX       (TIMING_PHASES * 3 *                        \
+                                 (TIMING_NAME_MAX + 5 + 10 + 5) + 1)
+
+void timingInit(void);
+void timingPhaseStart(timingPhase phase);
+void timingPhaseEnd(timingPhase phase);
+void timingReset(void);
+int32_t timingFormat(char * buf, uint32_t size);
+
+/* A single reading of every sensor, taken once per wake. Values are held
+ * fixed point in the units of the matching unitCode. */
+typedef struct {
+    clarityTimeDate timestamp;
+    bool luxValid;
+    bool barometerValid;
+    int32_t lux;            /* lx */
+    int32_t temperature;    /* K * 100 */
+    int32_t pressure;       /* kPa * 100 */
+} sensorSample;
+
+/* Binary measurement records. Each record is MEASUREMENT_RECORD_SIZE bytes,
+ * little endian: sensor id (1), unit code (1), scaled value (4),
+ * sample time in seconds since 2000-01-01 (4). Must match log_data.py. */
+#define MEASUREMENT_CONTENT_TYPE    "application/x-fyp-measurements"
+#define MEASUREMENT_RECORD_SIZE     10
+
+typedef enum {
+    SENSOR_ID_LUX           = 1,
+    SENSOR_ID_TEMPERATURE   = 2,
+    SENSOR_ID_PRESSURE      = 3
+} sensorId;
 
 void initialiseSensorHw(void);
 void deinitialiseSensorHw(void);
+int32_t sensorSampleUpdate(void);
+void sensorServiceStart(bool sampled);
+void sensorServiceStop(void);
+int32_t sensorSampleWait(systime_t timeout);
+void sensorSampleGet(sensorSample * copy);
 
 uint32_t httpGetPressure(const clarityHttpRequestInformation * info, 
                          clarityConnectionInformation * conn);
@@ -86,12 +212,21 @@ uint32_t httpGetTemperature(const clarityHttpRequestInformation * info,
                             clarityConnectionInformation * conn);
 uint32_t httpGetLux(const clarityHttpRequestInformation * info, 
                     clarityConnectionInformation * conn);
-clarityError httpPostTemperature(clarityTransportInformation * tcp,
+uint32_t httpGetStats(const clarityHttpRequestInformation * info, 
+                      clarityConnectionInformation * conn);
+clarityError httpPostBatch(clarityTransportInformation * tcp,
+                           clarityHttpPersistant * persistant);
+clarityError httpPostBatchBinary(clarityTransportInformation * tcp,
                                  clarityHttpPersistant * persistant);
-clarityError httpPostPressure(clarityTransportInformation * tcp,
-                              clarityHttpPersistant * persistant);
-clarityError httpPostLux(clarityTransportInformation * tcp,
-                         clarityHttpPersistant * persistant);
+clarityError httpPostSampleLog(clarityTransportInformation * tcp,
+                               clarityHttpPersistant * persistant);
+uint16_t measurementEncodeSample(uint8_t * buf, const sensorSample * sample);
+clarityError udpPostSample(const clarityTransportInformation * dest,
+                           bool ackRequired);
+
+clarityError addressResolve(const char * url, uint32_t * ip);
+void addressCacheLookup(const char * url, clarityAddressInformation * addr);
+bool addressCacheRefresh(const char * url, clarityAddressInformation * addr);
 
 
 typedef enum {
@@ -100,15 +235,37 @@ typedef enum {
     EEPROM_ERROR_FALSE  = 1,
     EEPROM_ERROR_CORRUPT= 2,
     EEPROM_ERROR_LOCK   = 3,
-    EEPROM_ERROR_MISC   = 4
+    EEPROM_ERROR_MISC   = 4,
+    EEPROM_ERROR_EMPTY  = 5
 } eepromError;
 
+/* Types of record held in the EEPROM record log */
+typedef enum {
+    EEPROM_RECORD_STORE     = 1,    /* Shutdown bookkeeping */
+    EEPROM_RECORD_POLICY    = 2,    /* Reporting policy state */
+    EEPROM_RECORD_CLOCK     = 3,    /* Last SNTP sync and RTC drift */
+    EEPROM_RECORD_TYPES             /* Must be last, at most 16 */
+} eepromRecordType;
+
 eepromError eepromWasLastShutdownOk(void);
 eepromError eepromAcknowledgeLastShutdownError(void);
 eepromError eepromRecordUnresponsiveShutdown(void);
 eepromError eepromWipeStore(void);
+eepromError eepromRecordRead(eepromRecordType type, void * data, uint32_t size);
+eepromError eepromRecordWrite(eepromRecordType type, const void * data,
+                              uint32_t size);
 #if 0
 eepromError eepromRecordShutdown(void);
 #endif
 
+eepromError eepromSampleLogAppend(const sensorSample * sample);
+uint32_t eepromSampleLogCount(void);
+uint32_t eepromSampleLogCapacity(void);
+eepromError eepromSampleLogRead(uint32_t index, sensorSample * sample);
+eepromError eepromSampleLogDiscard(uint32_t samples);
+
+bool policyReportDue(const sensorSample * sample);
+void policyReported(const sensorSample * sample);
+uint32_t policyStandbySeconds(void);
+
 #endif /*__FYP_H__*/
@@ -0,0 +1,55 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Host stand-in for the ChibiOS CC3000 SPI driver's API. There is no radio,
+ * the sockets it would provide are host sockets, see sim_cc3000.c. */
+
+#ifndef _CC3000_CHIBIOS_API_H_
+#define _CC3000_CHIBIOS_API_H_
+
+#include "ch.h"
+#include "hal.h"
+
+typedef void (*cc3000PrintCb)(const char * fmt, ...);
+
+#include "cc3000_chibios_config.h"
+
+#define WLAN_SEC_UNSEC              0
+#define WLAN_SEC_WEP                1
+#define WLAN_SEC_WPA                2
+#define WLAN_SEC_WPA2               3
+
+void cc3000ChibiosWlanInit(SPIDriver * suppliedSpiDriver,
+                           SPIConfig * suppliedSpiConfig,
+                           EXTDriver * suppliedExtDriver,
+                           EXTConfig * suppliedExtConfig,
+                           char * (*fwPatch)(unsigned long * length),
+                           char * (*driverPatch)(unsigned long * length),
+                           char * (*bootLoaderPatch)(unsigned long * length),
+                           cc3000PrintCb print);
+void cc3000ChibiosShutdown(void);
+
+#endif /* _CC3000_CHIBIOS_API_H_ */
@@ -0,0 +1,154 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Host stand-in for the subset of the ChibiOS/RT 2.6 kernel API used by the
+ * firmware. Threads are pthreads and every blocking primitive is built on a
+ * single kernel lock, so the scheduling is not ChibiOS's but the semantics the
+ * firmware relies on are. Sleeps advance virtual time instead of waiting, see
+ * sim_kernel.c. */
+
+#ifndef _CH_H_
+#define _CH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#ifndef FALSE
+#define FALSE                   0
+#endif
+#ifndef TRUE
+#define TRUE                    (!FALSE)
+#endif
+
+typedef int32_t                 msg_t;
+typedef uint32_t                systime_t;
+typedef int32_t                 cnt_t;
+typedef uint32_t                tprio_t;
+typedef uint8_t                 tmode_t;
+typedef int32_t                 bool_t;
+typedef uint64_t                stkalign_t;
+
+#define RDY_OK                  0
+#define RDY_TIMEOUT             -1
+#define RDY_RESET               -2
+
+#define TIME_IMMEDIATE          ((systime_t)0)
+#define TIME_INFINITE           ((systime_t)-1)
+
+#define CH_FREQUENCY            1000
+
+#define S2ST(sec)                                                           \
+        ((systime_t)((uint32_t)(sec) * (uint32_t)CH_FREQUENCY))
+#define MS2ST(msec)                                                         \
+        ((systime_t)((((uint32_t)(msec) * (uint32_t)CH_FREQUENCY - 1UL) /   \
+                      1000UL) + 1UL))
+
+#define IDLEPRIO                1
+#define LOWPRIO                 2
+#define NORMALPRIO              64
+#define HIGHPRIO                127
+#define ABSPRIO                 255
+
+#define THD_STATE_READY         0
+#define THD_STATE_FINAL         14
+
+typedef msg_t (*tfunc_t)(void *);
+
+typedef struct Mutex Mutex;
+
+typedef struct Thread {
+    struct Thread *p_newer;         /* Registry, oldest is the main thread */
+    struct Thread *p_older;
+    const char *p_name;
+    tprio_t p_prio;
+    tmode_t p_state;
+    systime_t p_vtime;              /* Virtual time this thread has reached */
+    volatile systime_t p_time;      /* CPU time, refreshed by the registry */
+    stkalign_t *p_stklimit;         /* Start of the filled area after this */
+    Mutex *p_mtxlist;               /* Owned mutexes, most recent first */
+    msg_t p_exitcode;
+    tfunc_t p_func;
+    void *p_arg;
+    pthread_t p_pthread;
+} Thread;
+
+struct Mutex {
+    Thread *m_owner;
+    Mutex *m_next;
+};
+
+typedef struct {
+    bool_t bs_taken;
+} BinarySemaphore;
+
+/* Working areas only hold the Thread, the thread itself runs on a pthread
+ * stack. The rest of the area is filled as ChibiOS does but never used. */
+#define CH_STACK_FILL_VALUE     0x55
+#define STACK_ALIGN(n)          ((((n) - 1) | (sizeof(stkalign_t) - 1)) + 1)
+#define THD_WA_SIZE(n)          STACK_ALIGN(sizeof(Thread) + (n))
+#define WORKING_AREA(s, n)      stkalign_t s[THD_WA_SIZE(n) / sizeof(stkalign_t)]
+
+void chSysInit(void);
+void chSysLock(void);
+void chSysUnlock(void);
+#define chSysLockFromIsr()      chSysLock()
+#define chSysUnlockFromIsr()    chSysUnlock()
+
+systime_t chTimeNow(void);
+
+Thread * chThdCreateStatic(void * wsp, size_t size, tprio_t prio,
+                           tfunc_t pf, void * arg);
+msg_t chThdWait(Thread * tp);
+Thread * chThdSelf(void);
+void chThdSleep(systime_t time);
+#define chThdSleepMilliseconds(msec)    chThdSleep(MS2ST(msec))
+void chThdYield(void);
+void chThdExit(msg_t msg);
+
+#define chRegSetThreadName(p)   (chThdSelf()->p_name = (p))
+#define chRegGetThreadName(tp)  ((tp)->p_name)
+Thread * chRegFirstThread(void);
+Thread * chRegNextThread(Thread * tp);
+
+void chMtxInit(Mutex * mp);
+void chMtxLock(Mutex * mp);
+Mutex * chMtxUnlock(void);
+
+void chBSemInit(BinarySemaphore * bsp, bool_t taken);
+msg_t chBSemWait(BinarySemaphore * bsp);
+msg_t chBSemWaitTimeout(BinarySemaphore * bsp, systime_t time);
+void chBSemSignal(BinarySemaphore * bsp);
+void chBSemReset(BinarySemaphore * bsp, bool_t taken);
+
+size_t chHeapStatus(void * heapp, size_t * sizep);
+size_t chCoreStatus(void);
+
+#define chDbgAssert(c, m, r)    ((void)(c))
+
+#endif /* _CH_H_ */
@@ -0,0 +1,181 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Host stand-in for the subset of the clarity API used by the firmware.
+ * Requests go over host TCP sockets to the collector and the HTTP server
+ * listens on a host port, see sim_clarity.c. */
+
+#ifndef _CLARITY_API_H_
+#define _CLARITY_API_H_
+
+#include "ch.h"
+
+#define CLARITY_MAX_URL_LENGTH              64
+#define CLARITY_HTTP_MAX_RESOURCES          8
+#define CLARITY_HTTP_MAX_METHODS            4
+
+typedef enum {
+    CLARITY_SUCCESS = 0,
+    CLARITY_ERROR_UNDEFINED,
+    CLARITY_ERROR_CC3000_WLAN,
+    CLARITY_ERROR_CC3000_SOCKET,
+    CLARITY_ERROR_REMOTE_REQUEST,
+    CLARITY_ERROR_BUFFER_SIZE,
+    CLARITY_ERROR_STATE
+} clarityError;
+
+typedef enum {
+    GET,
+    POST,
+    PUT,
+    DELETE
+} clarityHttpMethodType;
+
+typedef struct {
+    clarityHttpMethodType type;
+    const char * resource;          /* Path with any query string removed */
+    const char * query;             /* After the '?', or empty */
+    const char * body;
+    uint16_t bodyLen;
+} clarityHttpRequestInformation;
+
+typedef struct {
+    int socket;
+} clarityConnectionInformation;
+
+typedef uint32_t (*clarityHttpResourceCallback)(
+                            const clarityHttpRequestInformation * info,
+                            clarityConnectionInformation * conn);
+
+typedef struct {
+    clarityHttpMethodType type;
+    clarityHttpResourceCallback callback;
+} clarityHttpMethod;
+
+typedef struct {
+    const char * name;
+    clarityHttpMethod methods[CLARITY_HTTP_MAX_METHODS];
+} clarityHttpResource;
+
+typedef struct {
+    clarityHttpResource resources[CLARITY_HTTP_MAX_RESOURCES];
+} clarityHttpServerInformation;
+
+typedef enum {
+    CLARITY_ADDRESS_IP,
+    CLARITY_ADDRESS_URL
+} clarityAddressType;
+
+typedef struct {
+    clarityAddressType type;
+    union {
+        uint32_t ip;                /* Host byte order */
+        char url[CLARITY_MAX_URL_LENGTH];
+    } addr;
+} clarityAddressInformation;
+
+typedef enum {
+    CLARITY_TRANSPORT_TCP,
+    CLARITY_TRANSPORT_UDP
+} clarityTransportType;
+
+typedef struct {
+    clarityTransportType type;
+    clarityAddressInformation addr;
+    uint16_t port;
+} clarityTransportInformation;
+
+typedef struct {
+    bool closeOnComplete;
+} clarityHttpPersistant;
+
+typedef struct {
+    uint16_t code;
+} clarityHttpResponseInformation;
+
+typedef struct {
+    struct {
+        uint8_t year;               /* Since 2000 */
+        uint8_t month;
+        uint8_t date;
+        uint8_t day;                /* Monday is 1 */
+    } date;
+    struct {
+        uint8_t hour;
+        uint8_t minute;
+        uint8_t second;
+    } time;
+} clarityTimeDate;
+
+typedef struct {
+    bool dhcp;
+    uint32_t ip;
+    uint32_t subnet;
+    uint32_t gateway;
+    uint32_t dns;
+} clarityDeviceIpInformation;
+
+typedef struct {
+    const char * name;
+    uint32_t secType;
+    const char * key;
+    clarityDeviceIpInformation deviceIp;
+} clarityAccessPointInformation;
+
+typedef void (*clarityCC3000UnresponsiveCallback)(void);
+typedef void (*clarityPrintCallback)(const char * fmt, ...);
+
+clarityError clarityInit(Mutex * cc3000Mutex,
+                         clarityCC3000UnresponsiveCallback unresponsiveCb,
+                         clarityAccessPointInformation * accessPointConnection,
+                         clarityPrintCallback printCb);
+clarityError clarityShutdown(void);
+void clarityRegisterProcessStarted(void);
+void clarityRegisterProcessFinished(void);
+
+int16_t clarityHttpBuildPost(char * buf, uint16_t bufSize,
+                             const char * dir, const char * resource,
+                             const char * body,
+                             const clarityHttpPersistant * persistant);
+clarityError clarityHttpSendRequest(clarityTransportInformation * transport,
+                                    clarityHttpPersistant * persistant,
+                                    char * buf, uint16_t bufSize,
+                                    uint16_t requestSize,
+                                    clarityHttpResponseInformation * response);
+int16_t clarityHttpBuildResponseTextPlain(char * buf, uint16_t bufSize,
+                                          uint16_t code, const char * reason,
+                                          const char * body);
+
+clarityError clarityHttpServerStart(clarityHttpServerInformation * control);
+clarityError clarityHttpServerStop(void);
+uint32_t clarityHttpServerSendInCb(clarityConnectionInformation * conn,
+                                   const void * data, uint16_t length);
+
+clarityError clarityTimeIncrement(clarityTimeDate * td, uint32_t seconds);
+clarityError clarityGetSntpTime(char * buf, uint16_t bufSize, uint32_t * sntp);
+clarityError clarityTimeFromSntp(clarityTimeDate * td, uint32_t sntp);
+
+#endif /* _CLARITY_API_H_ */
@@ -0,0 +1,297 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Host stand-in for the ChibiOS HAL drivers and STM32L1xx registers used by
+ * the firmware. The RTC and its backup registers live in memory shared by
+ * every simulated wake, the EEPROM is a file mapped at its real address and
+ * the I2C bus is answered by models of the sensors. See sim_hal.c. */
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include "ch.h"
+#include "board.h"
+
+#define SPI_USE_MUTUAL_EXCLUSION    TRUE
+#define I2C_USE_MUTUAL_EXCLUSION    TRUE
+
+/* Nominal core clock, the DWT cycle counter is scaled to it. */
+#define STM32_SYSCLK                32000000
+
+/*===========================================================================*/
+/* Registers                                                                 */
+/*===========================================================================*/
+
+typedef struct {
+    volatile uint32_t TR, DR, CR, ISR, PRER, WUTR, CALIBR, ALRMAR, ALRMBR, WPR;
+    volatile uint32_t SSR, SHIFTR, TSTR, TSDR, TSSSR, CALR, TAFCR, ALRMASSR;
+    volatile uint32_t ALRMBSSR, RESERVED7;
+    volatile uint32_t BKP0R, BKP1R, BKP2R, BKP3R, BKP4R, BKP5R, BKP6R, BKP7R;
+    volatile uint32_t BKP8R, BKP9R, BKP10R, BKP11R, BKP12R, BKP13R, BKP14R;
+    volatile uint32_t BKP15R, BKP16R, BKP17R, BKP18R, BKP19R, BKP20R, BKP21R;
+    volatile uint32_t BKP22R, BKP23R, BKP24R, BKP25R, BKP26R, BKP27R, BKP28R;
+    volatile uint32_t BKP29R, BKP30R, BKP31R;
+} RTC_TypeDef;
+
+#define RTC_CR_WUCKSEL              0x00000007
+#define RTC_CR_WUCKSEL_2            0x00000004
+#define RTC_CR_ALRAE                0x00000100
+#define RTC_CR_ALRBE                0x00000200
+#define RTC_CR_WUTE                 0x00000400
+#define RTC_CR_ALRAIE               0x00001000
+#define RTC_CR_WUTIE                0x00004000
+#define RTC_ISR_WUTWF               0x00000004
+#define RTC_ISR_ALRAF               0x00000100
+#define RTC_ISR_WUTF                0x00000400
+
+typedef struct {
+    volatile uint32_t CR, CSR;
+} PWR_TypeDef;
+
+#define PWR_CR_LPSDSR               0x00000001
+#define PWR_CR_PDDS                 0x00000002
+#define PWR_CR_CWUF                 0x00000004
+#define PWR_CR_CSBF                 0x00000008
+#define PWR_CR_DBP                  0x00000100
+#define PWR_CSR_WUF                 0x00000001
+#define PWR_CSR_SBF                 0x00000002
+
+typedef struct {
+    volatile uint32_t ACR, PECR, PDKEYR, PEKEYR, PRGKEYR, OPTKEYR, SR, OBR;
+} FLASH_TypeDef;
+
+#define FLASH_PECR_PELOCK           0x00000001
+#define FLASH_PECR_FTDW             0x00000100
+#define FLASH_SR_BSY                0x00000001
+
+typedef struct {
+    volatile uint32_t IDCODE, CR;
+} DBGMCU_TypeDef;
+
+#define DBGMCU_CR_DBG_STANDBY       0x00000004
+
+typedef struct {
+    volatile uint32_t CPUID, ICSR, VTOR, AIRCR, SCR;
+} SCB_Type;
+
+#define SCB_SCR_SLEEPDEEP_Msk       0x00000004
+
+typedef struct {
+    volatile uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk      0x00000001
+
+typedef struct {
+    volatile uint32_t DHCSR, DCRSR, DCRDR, DEMCR;
+} CoreDebug_Type;
+
+#define CoreDebug_DEMCR_TRCENA_Msk  0x01000000
+
+typedef struct {
+    volatile uint32_t DR, IDR, CR;
+} CRC_TypeDef;
+
+#define CRC_CR_RESET                0x00000001
+
+typedef struct {
+    volatile uint32_t CR, ICSCR, CFGR, CIR, AHBRSTR, APB2RSTR, APB1RSTR;
+    volatile uint32_t AHBENR;
+} RCC_TypeDef;
+
+#define RCC_AHBENR_CRCEN            0x00001000
+
+/* The backup domain outlives each simulated wake. FLASH and DWT are
+ * refreshed on every access so they can follow the unlock sequence and the
+ * host clock. */
+extern RTC_TypeDef * simRtcRegisters;
+extern PWR_TypeDef simPwr;
+extern DBGMCU_TypeDef simDbgmcu;
+extern SCB_Type simScb;
+extern CoreDebug_Type simCoreDebug;
+extern CRC_TypeDef simCrc;
+extern RCC_TypeDef simRcc;
+FLASH_TypeDef * simFlash(void);
+DWT_Type * simDwt(void);
+
+#define RTC                         simRtcRegisters
+#define PWR                         (&simPwr)
+#define DBGMCU                      (&simDbgmcu)
+#define SCB                         (&simScb)
+#define CoreDebug                   (&simCoreDebug)
+#define CRC                         (&simCrc)
+#define RCC                         (&simRcc)
+#define FLASH                       simFlash()
+#define DWT                         simDwt()
+
+/* Ends the wake if standby has been configured, see sim_hal.c. */
+void __WFI(void);
+
+/*===========================================================================*/
+/* PAL                                                                       */
+/*===========================================================================*/
+
+typedef struct {
+    volatile uint32_t IDR;
+    volatile uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef GPIO_TypeDef * ioportid_t;
+
+extern GPIO_TypeDef simGpioA, simGpioB, simGpioC;
+#define GPIOA                       (&simGpioA)
+#define GPIOB                       (&simGpioB)
+#define GPIOC                       (&simGpioC)
+
+#define PAL_MODE_RESET              0
+#define PAL_MODE_UNCONNECTED        1
+#define PAL_MODE_INPUT              2
+#define PAL_MODE_OUTPUT_PUSHPULL    3
+#define PAL_MODE_ALTERNATE(n)       (((n) << 7) | 4)
+#define PAL_STM32_OTYPE_PUSHPULL    0
+#define PAL_STM32_OTYPE_OPENDRAIN   (1 << 2)
+#define PAL_STM32_OSPEED_LOWEST     0
+#define PAL_STM32_OSPEED_MID2       (2 << 3)
+#define PAL_STM32_OSPEED_HIGHEST    (3 << 3)
+
+uint32_t simPalReadPort(ioportid_t port);
+#define palSetPadMode(port, pad, mode)  ((void)(port), (void)(pad), (void)(mode))
+#define palSetPad(port, pad)        ((port)->ODR |= 1U << (pad))
+#define palClearPad(port, pad)      ((port)->ODR &= ~(1U << (pad)))
+#define palTogglePad(port, pad)     ((port)->ODR ^= 1U << (pad))
+#define palReadPad(port, pad)       ((simPalReadPort(port) >> (pad)) & 1)
+
+/*===========================================================================*/
+/* Drivers                                                                   */
+/*===========================================================================*/
+
+struct BaseSequentialStreamVMT {
+    size_t (*write)(void * instance, const uint8_t * bp, size_t n);
+};
+
+typedef struct {
+    const struct BaseSequentialStreamVMT * vmt;
+} BaseSequentialStream;
+
+#define chSequentialStreamWrite(ip, bp, n)  ((ip)->vmt->write(ip, bp, n))
+
+typedef struct {
+    BaseSequentialStream stream;
+} SerialDriver;
+
+extern SerialDriver SD2;
+void sdStart(SerialDriver * sdp, const void * config);
+void sdStop(SerialDriver * sdp);
+
+typedef struct SPIDriver SPIDriver;
+typedef void (*spicallback_t)(SPIDriver * spip);
+
+typedef struct {
+    spicallback_t end_cb;
+    ioportid_t ssport;
+    uint16_t sspad;
+    uint16_t cr1;
+} SPIConfig;
+
+struct SPIDriver {
+    const SPIConfig * config;
+    Mutex mutex;
+};
+
+#define SPI_CR1_CPHA                0x0001
+#define SPI_CR1_BR_0                0x0008
+#define SPI_CR1_BR_1                0x0010
+
+extern SPIDriver SPID2;
+void spiObjectInit(SPIDriver * spip);
+#define spiAcquireBus(spip)         chMtxLock(&(spip)->mutex)
+#define spiReleaseBus(spip)         ((void)(spip), (void)chMtxUnlock())
+
+typedef struct {
+    int dummy;
+} EXTConfig;
+
+typedef struct {
+    const EXTConfig * config;
+} EXTDriver;
+
+extern EXTDriver EXTD1;
+void extObjectInit(EXTDriver * extp);
+
+typedef uint16_t i2caddr_t;
+typedef uint32_t i2cflags_t;
+
+#define OPMODE_I2C                  1
+#define STD_DUTY_CYCLE              1
+
+typedef struct {
+    int op_mode;
+    uint32_t clock_speed;
+    int duty_cycle;
+} I2CConfig;
+
+typedef struct {
+    const I2CConfig * config;
+    bool started;
+    Mutex mutex;
+} I2CDriver;
+
+extern I2CDriver I2CD2;
+void i2cObjectInit(I2CDriver * i2cp);
+void i2cStart(I2CDriver * i2cp, const I2CConfig * config);
+void i2cStop(I2CDriver * i2cp);
+#define i2cAcquireBus(i2cp)         chMtxLock(&(i2cp)->mutex)
+#define i2cReleaseBus(i2cp)         ((void)(i2cp), (void)chMtxUnlock())
+msg_t i2cMasterTransmitTimeout(I2CDriver * i2cp, i2caddr_t addr,
+                               const uint8_t * txbuf, size_t txbytes,
+                               uint8_t * rxbuf, size_t rxbytes,
+                               systime_t timeout);
+
+typedef struct {
+    uint32_t tv_date;
+    uint32_t tv_time;
+    bool_t h12;
+} RTCTime;
+
+typedef struct {
+    uint32_t tv_datetime;
+} RTCAlarm;
+
+typedef uint32_t rtcalarm_t;
+
+typedef struct {
+    int dummy;
+} RTCDriver;
+
+extern RTCDriver RTCD1;
+void rtcGetTime(RTCDriver * rtcp, RTCTime * timespec);
+void rtcSetTime(RTCDriver * rtcp, const RTCTime * timespec);
+void rtcSetAlarm(RTCDriver * rtcp, rtcalarm_t alarm,
+                 const RTCAlarm * alarmspec);
+
+void halInit(void);
+
+#endif /* _HAL_H_ */
@@ -0,0 +1,72 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Host stand-in for the CC3000 host driver's socket.h. The BSD style names
+ * are mapped onto sim_cc3000.c so they can't collide with the host's own
+ * socket API. Addresses use the CC3000's layout: port then IPv4 address,
+ * both big endian, at the start of sa_data. */
+
+#ifndef _CC3000_SOCKET_H_
+#define _CC3000_SOCKET_H_
+
+#include <stdint.h>
+
+#define socket                      simCc3000Socket
+#define closesocket                 simCc3000CloseSocket
+#define sendto                      simCc3000SendTo
+#define recvfrom                    simCc3000RecvFrom
+#define setsockopt                  simCc3000SetSockOpt
+#define gethostbyname               simCc3000GetHostByName
+
+#define AF_INET                     2
+#define SOCK_STREAM                 1
+#define SOCK_DGRAM                  2
+#define IPPROTO_TCP                 6
+#define IPPROTO_UDP                 17
+#define SOL_SOCKET                  0xffff
+#define SOCKOPT_RECV_NONBLOCK       0
+#define SOCKOPT_RECV_TIMEOUT        1
+#define SOCKOPT_NONBLOCK            2
+
+typedef struct {
+    uint16_t sa_family;
+    uint8_t sa_data[14];
+} sockaddr;
+
+typedef int32_t socklen_t;
+
+long socket(long domain, long type, long protocol);
+long closesocket(long sd);
+int sendto(long sd, const void * buf, long len, long flags,
+           const sockaddr * to, socklen_t tolen);
+int recvfrom(long sd, void * buf, long len, long flags, sockaddr * from,
+             socklen_t * fromlen);
+int setsockopt(long sd, long level, long optname, const void * optval,
+               socklen_t optlen);
+int gethostbyname(char * hostname, unsigned short usNameLen,
+                  unsigned long * out_ip_addr);
+
+#endif /* _CC3000_SOCKET_H_ */
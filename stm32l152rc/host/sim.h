@@ -0,0 +1,141 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Internals shared by the host simulation's stand-ins. Each wake runs in a
+ * forked process so the firmware starts from clean RAM as it would after
+ * standby; everything that must outlive a wake is in simState, which is
+ * shared with the harness. */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "fyp.h"
+
+/* Work counted while the firmware runs */
+typedef enum {
+    SIM_COUNT_I2C,              /* I2C transfers */
+    SIM_COUNT_I2C_ERROR,        /* Of which were NACKed */
+    SIM_COUNT_EEPROM_WORDS,     /* EEPROM words changed */
+    SIM_COUNT_TCP_CONNECT,      /* Connections to the collector */
+    SIM_COUNT_HTTP_REQUEST,     /* Requests sent to the collector */
+    SIM_COUNT_HTTP_ERROR,       /* Of which failed or weren't 200 */
+    SIM_COUNT_TX_BYTES,         /* Sent to the collector, TCP and UDP */
+    SIM_COUNT_RX_BYTES,
+    SIM_COUNT_UDP,              /* Datagrams sent */
+    SIM_COUNT_DNS,              /* Host name lookups */
+    SIM_COUNT_SNTP,             /* SNTP requests */
+    SIM_COUNT_HTTP_SERVED,      /* Requests answered by the HTTP server */
+    SIM_COUNTS                      /* Must be last */
+} simCountId;
+
+typedef struct {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t work[SIM_COUNTS];
+} simPhaseStats;
+
+/* The whole wake is accounted as one more phase */
+#define SIM_PHASE_WAKE          TIMING_PHASES
+#define SIM_PHASES              (TIMING_PHASES + 1)
+
+typedef struct {
+    RTC_TypeDef rtc;            /* Backup domain registers */
+    int64_t rtcUs;              /* RTC counter at the start of this wake */
+    int64_t trueUs;             /* Reference time at the start of this wake */
+    uint32_t standbySeconds;    /* Set by the wake that entered standby, 0
+                                   if the next boot is a reset */
+    uint32_t resets;            /* Boots that were a reset, see -b */
+    int64_t lastAwakeUs;        /* How long the last wake was awake */
+    int64_t scheduleDueUs[SCHEDULES];   /* Reference time each is next due */
+    int64_t scheduleEarlyUs[SCHEDULES]; /* Furthest each fired from due */
+    int64_t scheduleLateUs[SCHEDULES];
+    uint64_t scheduleFires[SCHEDULES];
+    uint64_t counters[SIM_COUNTS];
+    simPhaseStats phases[SIM_PHASES];
+} simState;
+
+typedef struct {
+    uint32_t wakes;
+    const char * eepromPath;
+    bool wipeEeprom;
+    const char * serialPath;    /* Serial port output, discarded if NULL */
+    uint32_t collectorIp;       /* Every name resolves to this */
+    uint16_t tcpPort;           /* Overrides the firmware's port if set */
+    uint16_t udpPort;
+    uint16_t httpPort;          /* HTTP server port, 0 to not listen */
+    uint32_t serveMs;           /* Real time before the button is pressed */
+    uint32_t speedup;           /* Virtual time over real time for timeouts */
+    int32_t rtcPpm;             /* RTC crystal error */
+    uint32_t i2cErrorPerMille;
+    uint32_t resetEvery;        /* Wakes between resets, 0 for none */
+    uint32_t seed;
+} simConfig;
+
+extern simState * sim;
+extern simConfig simCfg;
+extern uint32_t simWake;        /* Number of this wake, from 0 */
+extern uint64_t simWakeStartNs;
+extern int simSerialFd;
+
+/* Exit status of a wake that didn't reach standby */
+#define SIM_EXIT_RETURNED       2   /* main() returned */
+#define SIM_EXIT_NO_WAKE        3   /* Standby with no wake source */
+#define SIM_EXIT_SCHEDULE       4   /* A schedule fired too early or late */
+
+void simCount(simCountId id, uint64_t n);
+uint64_t simMonotonicNs(void);
+
+/* sim_kernel.c */
+void simKernelBoot(void);
+
+/* sim_hal.c */
+void simHalBoot(void);
+int64_t simTrueUsNow(void);
+int64_t simRtcUsNow(void);
+void simRtcAdvance(int64_t rtcUs);
+
+/* sim_sensors.c */
+msg_t simI2cTransfer(i2caddr_t addr, const uint8_t * tx, size_t txBytes,
+                     uint8_t * rx, size_t rxBytes);
+
+/* sim_clarity.c, host sockets for sim_cc3000.c */
+uint32_t simResolve(const char * name);
+int simUdpOpen(void);
+int simUdpSetTimeout(int fd, uint32_t ms);
+int simUdpSendTo(int fd, uint32_t ip, uint16_t port, const void * buf,
+                 uint32_t len);
+int simUdpRecvFrom(int fd, void * buf, uint32_t len, uint32_t * ip,
+                   uint16_t * port);
+void simUdpClose(int fd);
+
+/* sim_main.c */
+void simStandby(int64_t rtcUs);
+
+#endif /* _SIM_H_ */
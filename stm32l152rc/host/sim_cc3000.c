@@ -0,0 +1,148 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* CC3000 driver stand-in. Only the UDP sockets and host name lookups used by
+ * udp_upload.c and address_cache.c are supported, on top of the host sockets
+ * in sim_clarity.c. Receive timeouts are real time, not virtual. */
+
+#include <string.h>
+#include "sim.h"
+#include "cc3000_chibios_api.h"
+#include "socket.h"
+
+void cc3000ChibiosWlanInit(SPIDriver * suppliedSpiDriver,
+                           SPIConfig * suppliedSpiConfig,
+                           EXTDriver * suppliedExtDriver,
+                           EXTConfig * suppliedExtConfig,
+                           char * (*fwPatch)(unsigned long * length),
+                           char * (*driverPatch)(unsigned long * length),
+                           char * (*bootLoaderPatch)(unsigned long * length),
+                           cc3000PrintCb print)
+{
+    (void)suppliedSpiDriver;
+    (void)suppliedSpiConfig;
+    (void)suppliedExtDriver;
+    (void)suppliedExtConfig;
+    (void)fwPatch;
+    (void)driverPatch;
+    (void)bootLoaderPatch;
+    (void)print;
+}
+
+void cc3000ChibiosShutdown(void)
+{
+}
+
+long socket(long domain, long type, long protocol)
+{
+    (void)protocol;
+
+    if (domain != AF_INET || type != SOCK_DGRAM)
+    {
+        return -1;
+    }
+
+    return simUdpOpen();
+}
+
+long closesocket(long sd)
+{
+    simUdpClose(sd);
+
+    return 0;
+}
+
+int setsockopt(long sd, long level, long optname, const void * optval,
+               socklen_t optlen)
+{
+    if (level != SOL_SOCKET || optname != SOCKOPT_RECV_TIMEOUT ||
+        optlen < (socklen_t)sizeof(unsigned long))
+    {
+        return -1;
+    }
+
+    return simUdpSetTimeout(sd, *(const unsigned long *)optval);
+}
+
+int sendto(long sd, const void * buf, long len, long flags,
+           const sockaddr * to, socklen_t tolen)
+{
+    uint16_t port;
+    uint32_t ip;
+
+    (void)flags;
+    (void)tolen;
+
+    port = to->sa_data[0] << 8 | to->sa_data[1];
+    ip = (uint32_t)to->sa_data[2] << 24 | to->sa_data[3] << 16 |
+         to->sa_data[4] << 8 | to->sa_data[5];
+
+    return simUdpSendTo(sd, ip, port, buf, len);
+}
+
+int recvfrom(long sd, void * buf, long len, long flags, sockaddr * from,
+             socklen_t * fromlen)
+{
+    uint16_t port;
+    uint32_t ip;
+    int rxLen;
+
+    (void)flags;
+
+    if ((rxLen = simUdpRecvFrom(sd, buf, len, &ip, &port)) < 0)
+    {
+        return -1;
+    }
+
+    if (from != NULL)
+    {
+        memset(from, 0, sizeof(*from));
+        from->sa_family = AF_INET;
+        from->sa_data[0] = port >> 8;
+        from->sa_data[1] = port;
+        from->sa_data[2] = ip >> 24;
+        from->sa_data[3] = ip >> 16;
+        from->sa_data[4] = ip >> 8;
+        from->sa_data[5] = ip;
+    }
+
+    if (fromlen != NULL)
+    {
+        *fromlen = sizeof(*from);
+    }
+
+    return rxLen;
+}
+
+int gethostbyname(char * hostname, unsigned short usNameLen,
+                  unsigned long * out_ip_addr)
+{
+    (void)usNameLen;
+
+    *out_ip_addr = simResolve(hostname);
+
+    return 0;
+}
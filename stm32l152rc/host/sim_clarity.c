@@ -0,0 +1,886 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* clarity stand-in. Requests to the collector go over a host TCP connection,
+ * kept open between requests unless the caller asks for it to be closed,
+ * and the response is read back into the request buffer as clarity does.
+ * Every host name resolves to simCfg.collectorIp. The HTTP server listens on
+ * simCfg.httpPort, if set, and dispatches to the firmware's resources from
+ * its own thread, keeping connections alive. SNTP answers with the
+ * simulation's reference time. */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "sim.h"
+
+#define NET_TIMEOUT_MS          2000
+#define NTP_TO_2000_S           3155673600UL    /* 1900-01-01 to 2000-01-01 */
+
+/* The CC3000 has eight sockets, one is kept for the listener and one for
+ * requests to the collector. */
+#define SERVER_CLIENTS          6
+#define SERVER_REQUEST_SIZE     512
+#define SERVER_POLL_MS          10
+#define SERVER_RESPONSE_SIZE    128
+
+typedef struct {
+    int fd;
+    uint32_t len;
+    char buf[SERVER_REQUEST_SIZE];
+} serverClient;
+
+static Mutex * apiMutex;
+
+static int clientFd = -1;
+static uint32_t clientIp;
+static uint16_t clientPort;
+
+static clarityHttpServerInformation * serverInfo;
+static int listenFd = -1;
+static volatile bool serverStopping;
+static Thread * serverTp;
+static WORKING_AREA(serverWa, 256);
+static serverClient serverClients[SERVER_CLIENTS];
+
+static void apiLock(void)
+{
+    if (apiMutex != NULL)
+    {
+        chMtxLock(apiMutex);
+    }
+}
+
+static void apiUnlock(void)
+{
+    if (apiMutex != NULL)
+    {
+        chMtxUnlock();
+    }
+}
+
+static void setTimeouts(int fd, uint32_t ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int sendAll(int fd, const void * data, uint32_t len)
+{
+    const uint8_t * p = data;
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        if ((sent = send(fd, p, len, MSG_NOSIGNAL)) <= 0)
+        {
+            return -1;
+        }
+
+        p += sent;
+        len -= sent;
+    }
+
+    return 0;
+}
+
+uint32_t simResolve(const char * name)
+{
+    (void)name;
+
+    simCount(SIM_COUNT_DNS, 1);
+
+    return simCfg.collectorIp;
+}
+
+clarityError clarityInit(Mutex * cc3000Mutex,
+                         clarityCC3000UnresponsiveCallback unresponsiveCb,
+                         clarityAccessPointInformation * accessPointConnection,
+                         clarityPrintCallback printCb)
+{
+    (void)unresponsiveCb;
+    (void)accessPointConnection;
+    (void)printCb;
+
+    apiMutex = cc3000Mutex;
+
+    return CLARITY_SUCCESS;
+}
+
+static void clientClose(void)
+{
+    if (clientFd >= 0)
+    {
+        close(clientFd);
+        clientFd = -1;
+    }
+}
+
+clarityError clarityShutdown(void)
+{
+    clientClose();
+    apiMutex = NULL;
+
+    return CLARITY_SUCCESS;
+}
+
+void clarityRegisterProcessStarted(void)
+{
+}
+
+void clarityRegisterProcessFinished(void)
+{
+}
+
+/*===========================================================================*/
+/* Requests to the collector                                                 */
+/*===========================================================================*/
+
+int16_t clarityHttpBuildPost(char * buf, uint16_t bufSize,
+                             const char * dir, const char * resource,
+                             const char * body,
+                             const clarityHttpPersistant * persistant)
+{
+    int len = snprintf(buf, bufSize,
+                       "POST %s%s HTTP/1.1\r\n"
+                       "Host: clarity\r\n"
+                       "Content-Length: %u\r\n"
+                       "%s"
+                       "\r\n"
+                       "%s",
+                       dir, resource, (unsigned)strlen(body),
+                       persistant->closeOnComplete ? 
+                            "Connection: close\r\n" : "",
+                       body);
+
+    if (len < 0 || len >= bufSize)
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+static bool clientConnect(uint32_t ip, uint16_t port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if ((clientFd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        return false;
+    }
+
+    setTimeouts(clientFd, NET_TIMEOUT_MS);
+    setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(ip);
+
+    simCount(SIM_COUNT_TCP_CONNECT, 1);
+
+    if (connect(clientFd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        clientClose();
+        return false;
+    }
+
+    clientIp = ip;
+    clientPort = port;
+
+    return true;
+}
+
+/* Value of header name in the headers ending at end, or NULL */
+static const char * headerFind(const char * headers, const char * end,
+                               const char * name)
+{
+    const char * line = strstr(headers, "\r\n");
+    size_t nameLen = strlen(name);
+
+    while (line != NULL && line < end)
+    {
+        line += 2;
+
+        if (strncasecmp(line, name, nameLen) == 0 && line[nameLen] == ':')
+        {
+            line += nameLen + 1;
+
+            while (*line == ' ')
+            {
+                line++;
+            }
+
+            return line;
+        }
+
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+/* Reads the response into buf and discards any body that doesn't fit.
+ * received is set if anything at all came back. */
+static clarityError clientReceive(char * buf, uint16_t bufSize,
+                                  clarityHttpResponseInformation * response,
+                                  bool * keepAlive, bool * received)
+{
+    uint32_t len = 0;
+    uint32_t headerLen;
+    uint32_t contentLength = 0;
+    const char * end = NULL;
+    const char * value;
+    char discard[256];
+    ssize_t rxLen;
+    unsigned code;
+
+    *received = false;
+
+    while (end == NULL)
+    {
+        if (len >= (uint32_t)bufSize - 1)
+        {
+            return CLARITY_ERROR_BUFFER_SIZE;
+        }
+
+        if ((rxLen = recv(clientFd, buf + len, bufSize - 1 - len, 0)) <= 0)
+        {
+            return CLARITY_ERROR_REMOTE_REQUEST;
+        }
+
+        *received = true;
+        simCount(SIM_COUNT_RX_BYTES, rxLen);
+        len += rxLen;
+        buf[len] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+
+    if (sscanf(buf, "HTTP/1.%*u %u", &code) != 1)
+    {
+        return CLARITY_ERROR_REMOTE_REQUEST;
+    }
+
+    response->code = code;
+    headerLen = end + 4 - buf;
+
+    if ((value = headerFind(buf, end, "Content-Length")) != NULL)
+    {
+        contentLength = strtoul(value, NULL, 10);
+    }
+
+    value = headerFind(buf, end, "Connection");
+    *keepAlive = value == NULL || strncasecmp(value, "close", 5) != 0;
+
+    /* Anything past the buffer is read and dropped */
+    len -= headerLen;
+
+    while (len < contentLength)
+    {
+        rxLen = contentLength - len;
+
+        if ((rxLen = recv(clientFd, discard, 
+                          rxLen < (ssize_t)sizeof(discard) ? 
+                              rxLen : (ssize_t)sizeof(discard), 0)) <= 0)
+        {
+            return CLARITY_ERROR_REMOTE_REQUEST;
+        }
+
+        simCount(SIM_COUNT_RX_BYTES, rxLen);
+        len += rxLen;
+    }
+
+    return CLARITY_SUCCESS;
+}
+
+clarityError clarityHttpSendRequest(clarityTransportInformation * transport,
+                                    clarityHttpPersistant * persistant,
+                                    char * buf, uint16_t bufSize,
+                                    uint16_t requestSize,
+                                    clarityHttpResponseInformation * response)
+{
+    clarityError rtn = CLARITY_ERROR_REMOTE_REQUEST;
+    bool keepAlive = false;
+    bool received = false;
+    bool reused;
+    uint32_t attempt;
+    uint32_t ip;
+    uint16_t port;
+
+    if (transport->type != CLARITY_TRANSPORT_TCP)
+    {
+        return CLARITY_ERROR_UNDEFINED;
+    }
+
+    ip = transport->addr.type == CLARITY_ADDRESS_URL ?
+            simResolve(transport->addr.addr.url) : transport->addr.addr.ip;
+    port = simCfg.tcpPort != 0 ? simCfg.tcpPort : transport->port;
+
+    apiLock();
+
+    simCount(SIM_COUNT_HTTP_REQUEST, 1);
+
+    if (clientFd >= 0 && (clientIp != ip || clientPort != port))
+    {
+        clientClose();
+    }
+
+    /* A kept alive connection may have been closed by the collector since,
+     * which only shows once it is used. */
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        reused = clientFd >= 0;
+
+        if (reused == false && clientConnect(ip, port) == false)
+        {
+            rtn = CLARITY_ERROR_REMOTE_REQUEST;
+            break;
+        }
+
+        if (sendAll(clientFd, buf, requestSize) == 0)
+        {
+            simCount(SIM_COUNT_TX_BYTES, requestSize);
+            rtn = clientReceive(buf, bufSize, response, &keepAlive, &received);
+        }
+        else
+        {
+            rtn = CLARITY_ERROR_REMOTE_REQUEST;
+        }
+
+        if (rtn == CLARITY_SUCCESS || reused == false || received == true)
+        {
+            break;
+        }
+
+        clientClose();
+    }
+
+    if (rtn != CLARITY_SUCCESS || keepAlive == false ||
+        persistant->closeOnComplete == true)
+    {
+        clientClose();
+    }
+
+    apiUnlock();
+
+    if (rtn != CLARITY_SUCCESS || response->code != 200)
+    {
+        simCount(SIM_COUNT_HTTP_ERROR, 1);
+    }
+
+    return rtn;
+}
+
+/*===========================================================================*/
+/* HTTP server                                                               */
+/*===========================================================================*/
+
+int16_t clarityHttpBuildResponseTextPlain(char * buf, uint16_t bufSize,
+                                          uint16_t code, const char * reason,
+                                          const char * body)
+{
+    int len = snprintf(buf, bufSize,
+                       "HTTP/1.1 %u %s\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %u\r\n"
+                       "\r\n"
+                       "%s",
+                       code, reason, (unsigned)strlen(body), body);
+
+    if (len < 0 || len >= bufSize)
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+uint32_t clarityHttpServerSendInCb(clarityConnectionInformation * conn,
+                                   const void * data, uint16_t length)
+{
+    if (sendAll(conn->socket, data, length) != 0)
+    {
+        return 0;
+    }
+
+    return length;
+}
+
+static void serverClientClose(serverClient * client)
+{
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+}
+
+static bool serverRespond(int fd, uint16_t code, const char * reason)
+{
+    char response[SERVER_RESPONSE_SIZE];
+    int16_t len;
+
+    len = clarityHttpBuildResponseTextPlain(response, sizeof(response),
+                                            code, reason, reason);
+
+    return len > 0 && sendAll(fd, response, len) == 0;
+}
+
+static bool methodFromString(const char * str, clarityHttpMethodType * type)
+{
+    static const char * names[] = {[GET] = "GET", [POST] = "POST",
+                                   [PUT] = "PUT", [DELETE] = "DELETE"};
+    uint32_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcmp(str, names[i]) == 0)
+        {
+            *type = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static clarityHttpResourceCallback serverFindCallback(const char * path,
+                                                      clarityHttpMethodType type,
+                                                      bool * pathFound)
+{
+    clarityHttpResource * resource;
+    uint32_t r;
+    uint32_t m;
+
+    *pathFound = false;
+
+    for (r = 0; r < CLARITY_HTTP_MAX_RESOURCES; r++)
+    {
+        resource = &serverInfo->resources[r];
+
+        if (resource->name == NULL || strcmp(resource->name, path) != 0)
+        {
+            continue;
+        }
+
+        *pathFound = true;
+
+        for (m = 0; m < CLARITY_HTTP_MAX_METHODS; m++)
+        {
+            if (resource->methods[m].callback != NULL &&
+                resource->methods[m].type == type)
+            {
+                return resource->methods[m].callback;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Handles one complete request of requestLen bytes at the start of the
+ * client's buffer. Returns false if the connection should be closed. */
+static bool serverHandle(serverClient * client, uint32_t headerLen,
+                         uint32_t requestLen)
+{
+    clarityHttpRequestInformation info;
+    clarityConnectionInformation conn;
+    clarityHttpResourceCallback callback;
+    const char * value;
+    char method[8];
+    char path[SERVER_REQUEST_SIZE];
+    char * query;
+    unsigned minor;
+    bool keepAlive;
+    bool pathFound;
+
+    if (sscanf(client->buf, "%7s %511s HTTP/1.%u", method, path, &minor) != 3)
+    {
+        serverRespond(client->fd, 400, "Bad Request");
+        return false;
+    }
+
+    value = headerFind(client->buf, client->buf + headerLen - 2, "Connection");
+    keepAlive = minor >= 1 ?
+                    value == NULL || strncasecmp(value, "close", 5) != 0 :
+                    value != NULL && strncasecmp(value, "keep-alive", 10) == 0;
+
+    memset(&info, 0, sizeof(info));
+
+    if ((query = strchr(path, '?')) != NULL)
+    {
+        *query++ = '\0';
+    }
+
+    info.resource = path;
+    info.query = query != NULL ? query : "";
+    info.body = client->buf + headerLen;
+    info.bodyLen = requestLen - headerLen;
+
+    simCount(SIM_COUNT_HTTP_SERVED, 1);
+
+    if (methodFromString(method, &info.type) == false)
+    {
+        serverRespond(client->fd, 501, "Not Implemented");
+        return false;
+    }
+
+    if ((callback = serverFindCallback(path, info.type, &pathFound)) == NULL)
+    {
+        return (pathFound ? serverRespond(client->fd, 405, "Method Not Allowed") :
+                            serverRespond(client->fd, 404, "Not Found")) &&
+               keepAlive;
+    }
+
+    conn.socket = client->fd;
+
+    return callback(&info, &conn) == 0 && keepAlive;
+}
+
+static void serverReceive(serverClient * client)
+{
+    const char * end;
+    const char * value;
+    uint32_t headerLen;
+    uint32_t requestLen;
+    ssize_t rxLen;
+
+    rxLen = recv(client->fd, client->buf + client->len,
+                 sizeof(client->buf) - 1 - client->len, 0);
+
+    if (rxLen <= 0)
+    {
+        serverClientClose(client);
+        return;
+    }
+
+    client->len += rxLen;
+    client->buf[client->len] = '\0';
+
+    /* Pipelined requests are answered in turn */
+    while ((end = strstr(client->buf, "\r\n\r\n")) != NULL)
+    {
+        headerLen = end + 4 - client->buf;
+        requestLen = headerLen;
+
+        if ((value = headerFind(client->buf, end, "Content-Length")) != NULL)
+        {
+            requestLen += strtoul(value, NULL, 10);
+        }
+
+        if (requestLen >= sizeof(client->buf))
+        {
+            serverRespond(client->fd, 413, "Payload Too Large");
+            serverClientClose(client);
+            return;
+        }
+
+        if (requestLen > client->len)
+        {
+            return;
+        }
+
+        if (serverHandle(client, headerLen, requestLen) == false)
+        {
+            serverClientClose(client);
+            return;
+        }
+
+        client->len -= requestLen;
+        memmove(client->buf, client->buf + requestLen, client->len + 1);
+    }
+
+    if (client->len >= sizeof(client->buf) - 1)
+    {
+        serverRespond(client->fd, 431, "Request Header Fields Too Large");
+        serverClientClose(client);
+    }
+}
+
+static void serverAccept(void)
+{
+    uint32_t i;
+    int fd;
+    int one = 1;
+
+    if ((fd = accept(listenFd, NULL, NULL)) < 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < SERVER_CLIENTS; i++)
+    {
+        if (serverClients[i].fd < 0)
+        {
+            setTimeouts(fd, NET_TIMEOUT_MS);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            serverClients[i].fd = fd;
+            serverClients[i].len = 0;
+            return;
+        }
+    }
+
+    close(fd);
+}
+
+static msg_t serverThread(void * arg)
+{
+    struct pollfd fds[SERVER_CLIENTS + 1];
+    bool slotFree;
+    uint32_t i;
+
+    (void)arg;
+
+    chRegSetThreadName("clarity");
+
+    while (serverStopping == false)
+    {
+        slotFree = false;
+
+        for (i = 0; i < SERVER_CLIENTS; i++)
+        {
+            fds[i].fd = serverClients[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            slotFree |= serverClients[i].fd < 0;
+        }
+
+        /* Further connections wait in the backlog until a slot frees */
+        fds[SERVER_CLIENTS].fd = slotFree ? listenFd : -1;
+        fds[SERVER_CLIENTS].events = POLLIN;
+        fds[SERVER_CLIENTS].revents = 0;
+
+        if (poll(fds, SERVER_CLIENTS + 1, SERVER_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        for (i = 0; i < SERVER_CLIENTS; i++)
+        {
+            if (fds[i].revents != 0 && serverClients[i].fd >= 0)
+            {
+                serverReceive(&serverClients[i]);
+            }
+        }
+
+        if (fds[SERVER_CLIENTS].revents & POLLIN)
+        {
+            serverAccept();
+        }
+    }
+
+    return 0;
+}
+
+clarityError clarityHttpServerStart(clarityHttpServerInformation * control)
+{
+    struct sockaddr_in addr;
+    uint32_t i;
+    int one = 1;
+
+    serverInfo = control;
+
+    if (simCfg.httpPort == 0)
+    {
+        return CLARITY_SUCCESS;
+    }
+
+    if ((listenFd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        return CLARITY_ERROR_CC3000_SOCKET;
+    }
+
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(simCfg.httpPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, 64) != 0)
+    {
+        perror("sim: HTTP server");
+        close(listenFd);
+        listenFd = -1;
+        return CLARITY_ERROR_CC3000_SOCKET;
+    }
+
+    for (i = 0; i < SERVER_CLIENTS; i++)
+    {
+        serverClients[i].fd = -1;
+        serverClients[i].len = 0;
+    }
+
+    serverStopping = false;
+    serverTp = chThdCreateStatic(serverWa, sizeof(serverWa), NORMALPRIO,
+                                 serverThread, NULL);
+
+    return CLARITY_SUCCESS;
+}
+
+clarityError clarityHttpServerStop(void)
+{
+    uint32_t i;
+
+    if (serverTp == NULL)
+    {
+        return CLARITY_SUCCESS;
+    }
+
+    serverStopping = true;
+    chThdWait(serverTp);
+    serverTp = NULL;
+
+    for (i = 0; i < SERVER_CLIENTS; i++)
+    {
+        if (serverClients[i].fd >= 0)
+        {
+            serverClientClose(&serverClients[i]);
+        }
+    }
+
+    close(listenFd);
+    listenFd = -1;
+
+    return CLARITY_SUCCESS;
+}
+
+/*===========================================================================*/
+/* Time                                                                      */
+/*===========================================================================*/
+
+clarityError clarityTimeIncrement(clarityTimeDate * td, uint32_t seconds)
+{
+    rtcSecondsToTimeDate(rtcTimeDateToSeconds(td) + seconds, td);
+
+    return CLARITY_SUCCESS;
+}
+
+clarityError clarityGetSntpTime(char * buf, uint16_t bufSize, uint32_t * sntp)
+{
+    (void)buf;
+    (void)bufSize;
+
+    apiLock();
+    simCount(SIM_COUNT_SNTP, 1);
+    *sntp = simTrueUsNow() / 1000000 + NTP_TO_2000_S;
+    apiUnlock();
+
+    return CLARITY_SUCCESS;
+}
+
+clarityError clarityTimeFromSntp(clarityTimeDate * td, uint32_t sntp)
+{
+    if (sntp < NTP_TO_2000_S)
+    {
+        return CLARITY_ERROR_UNDEFINED;
+    }
+
+    rtcSecondsToTimeDate(sntp - NTP_TO_2000_S, td);
+
+    return CLARITY_SUCCESS;
+}
+
+/*===========================================================================*/
+/* UDP for sim_cc3000.c                                                      */
+/*===========================================================================*/
+
+int simUdpOpen(void)
+{
+    return socket(AF_INET, SOCK_DGRAM, 0);
+}
+
+int simUdpSetTimeout(int fd, uint32_t ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int simUdpSendTo(int fd, uint32_t ip, uint16_t port, const void * buf,
+                 uint32_t len)
+{
+    struct sockaddr_in addr;
+    ssize_t sent;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(simCfg.udpPort != 0 ? simCfg.udpPort : port);
+    addr.sin_addr.s_addr = htonl(ip);
+
+    simCount(SIM_COUNT_UDP, 1);
+
+    if ((sent = sendto(fd, buf, len, 0, (struct sockaddr *)&addr, 
+                       sizeof(addr))) > 0)
+    {
+        simCount(SIM_COUNT_TX_BYTES, sent);
+    }
+
+    return sent;
+}
+
+int simUdpRecvFrom(int fd, void * buf, uint32_t len, uint32_t * ip,
+                   uint16_t * port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    ssize_t rxLen;
+
+    if ((rxLen = recvfrom(fd, buf, len, 0, (struct sockaddr *)&addr,
+                          &addrLen)) < 0)
+    {
+        return -1;
+    }
+
+    simCount(SIM_COUNT_RX_BYTES, rxLen);
+    *ip = ntohl(addr.sin_addr.s_addr);
+    *port = ntohs(addr.sin_port);
+
+    return rxLen;
+}
+
+void simUdpClose(int fd)
+{
+    close(fd);
+}
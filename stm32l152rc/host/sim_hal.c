@@ -0,0 +1,474 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* HAL and register stand-ins. The RTC counts in microseconds of its own
+ * crystal, which runs simCfg.rtcPpm fast against the reference time that
+ * SNTP reports. Entering standby ends the wake: the RTC and reference time
+ * are moved on to whichever of alarm A or the wakeup timer fires first. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+#include "chprintf.h"
+#include "memstreams.h"
+
+#define US_PER_S                1000000LL
+#define DAY_S                   (24 * 60 * 60)
+
+#define PEKEY1                  0x89ABCDEF
+#define PEKEY2                  0x02030405
+
+RTC_TypeDef * simRtcRegisters;
+PWR_TypeDef simPwr;
+DBGMCU_TypeDef simDbgmcu;
+SCB_Type simScb;
+CoreDebug_Type simCoreDebug;
+CRC_TypeDef simCrc;
+RCC_TypeDef simRcc;
+GPIO_TypeDef simGpioA, simGpioB, simGpioC;
+
+SerialDriver SD2;
+SPIDriver SPID2;
+EXTDriver EXTD1;
+I2CDriver I2CD2;
+RTCDriver RTCD1;
+
+static FLASH_TypeDef flash;
+static uint32_t flashLastKey;
+static DWT_Type dwt;
+static __thread unsigned int i2cSeed;
+
+static const struct BaseSequentialStreamVMT serialVmt;
+
+void simHalBoot(void)
+{
+    simRtcRegisters = &sim->rtc;
+
+    /* The wakeup timer can always be written while it is disabled */
+    RTC->ISR |= RTC_ISR_WUTWF;
+
+    if (sim->standbySeconds != 0)
+    {
+        simPwr.CSR |= PWR_CSR_SBF | PWR_CSR_WUF;
+    }
+
+    flash.PECR = FLASH_PECR_PELOCK;
+
+    SD2.stream.vmt = &serialVmt;
+}
+
+void halInit(void)
+{
+    spiObjectInit(&SPID2);
+    i2cObjectInit(&I2CD2);
+}
+
+/* The data EEPROM unlocks once PEKEY1 then PEKEY2 have been written. The
+ * writes can't be seen as they happen, but each is followed by another
+ * access. */
+FLASH_TypeDef * simFlash(void)
+{
+    if (flash.PEKEYR == PEKEY2 && flashLastKey == PEKEY1)
+    {
+        flash.PECR &= ~FLASH_PECR_PELOCK;
+    }
+
+    flashLastKey = flash.PEKEYR;
+
+    return &flash;
+}
+
+/* Counts host time at the nominal core clock */
+DWT_Type * simDwt(void)
+{
+    dwt.CYCCNT = simMonotonicNs() * (STM32_SYSCLK / 1000000) / 1000;
+
+    return &dwt;
+}
+
+/*===========================================================================*/
+/* PAL and serial                                                            */
+/*===========================================================================*/
+
+/* The button is pressed as soon as it is read, unless the HTTP server has
+ * been given time to serve. */
+uint32_t simPalReadPort(ioportid_t port)
+{
+    if (port == BUTTON_PORT)
+    {
+        if (simMonotonicNs() - simWakeStartNs >= 
+                (uint64_t)simCfg.serveMs * 1000000)
+        {
+            port->IDR |= 1U << BUTTON_PAD;
+        }
+        else
+        {
+            port->IDR &= ~(1U << BUTTON_PAD);
+        }
+    }
+
+    return port->IDR;
+}
+
+/* The serial port goes to the -l file, if any */
+static size_t serialWrite(void * instance, const uint8_t * bp, size_t n)
+{
+    (void)instance;
+
+    if (simSerialFd >= 0 && write(simSerialFd, bp, n) < 0)
+    {
+        return 0;
+    }
+
+    return n;
+}
+
+static const struct BaseSequentialStreamVMT serialVmt = {serialWrite};
+
+static size_t memoryWrite(void * instance, const uint8_t * bp, size_t n)
+{
+    MemoryStream * msp = instance;
+
+    if (n > msp->size - msp->eos)
+    {
+        n = msp->size - msp->eos;
+    }
+
+    memcpy(msp->buffer + msp->eos, bp, n);
+    msp->eos += n;
+
+    return n;
+}
+
+static const struct BaseSequentialStreamVMT memoryVmt = {memoryWrite};
+
+void msObjectInit(MemoryStream * msp, uint8_t * buffer, size_t size,
+                  size_t eos)
+{
+    msp->vmt = &memoryVmt;
+    msp->buffer = buffer;
+    msp->size = size;
+    msp->eos = eos;
+    msp->offset = 0;
+}
+
+void sdStart(SerialDriver * sdp, const void * config)
+{
+    (void)sdp;
+    (void)config;
+}
+
+void sdStop(SerialDriver * sdp)
+{
+    (void)sdp;
+}
+
+void chvprintf(BaseSequentialStream * chp, const char * fmt, va_list ap)
+{
+    char buf[256];
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+
+    if (len > 0)
+    {
+        chSequentialStreamWrite(chp, (const uint8_t *)buf, 
+                                (size_t)len < sizeof(buf) ? 
+                                    (size_t)len : sizeof(buf) - 1);
+    }
+}
+
+void chprintf(BaseSequentialStream * chp, const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    chvprintf(chp, fmt, ap);
+    va_end(ap);
+}
+
+/*===========================================================================*/
+/* SPI, EXT and I2C                                                          */
+/*===========================================================================*/
+
+void spiObjectInit(SPIDriver * spip)
+{
+    spip->config = NULL;
+    chMtxInit(&spip->mutex);
+}
+
+void extObjectInit(EXTDriver * extp)
+{
+    extp->config = NULL;
+}
+
+void i2cObjectInit(I2CDriver * i2cp)
+{
+    i2cp->config = NULL;
+    i2cp->started = false;
+    chMtxInit(&i2cp->mutex);
+}
+
+void i2cStart(I2CDriver * i2cp, const I2CConfig * config)
+{
+    i2cp->config = config;
+    i2cp->started = true;
+}
+
+void i2cStop(I2CDriver * i2cp)
+{
+    i2cp->started = false;
+}
+
+/* Transfers while the driver is stopped fail, as do simCfg.i2cErrorPerMille
+ * of the rest. */
+msg_t i2cMasterTransmitTimeout(I2CDriver * i2cp, i2caddr_t addr,
+                               const uint8_t * txbuf, size_t txbytes,
+                               uint8_t * rxbuf, size_t rxbytes,
+                               systime_t timeout)
+{
+    msg_t rtn;
+
+    (void)timeout;
+
+    if (i2cSeed == 0)
+    {
+        i2cSeed = simCfg.seed ^ (simWake * 2654435761U) ^ (uintptr_t)&i2cSeed;
+    }
+
+    simCount(SIM_COUNT_I2C, 1);
+
+    if (i2cp->started == false ||
+        (uint32_t)(rand_r(&i2cSeed) % 1000) < simCfg.i2cErrorPerMille)
+    {
+        rtn = RDY_RESET;
+    }
+    else
+    {
+        rtn = simI2cTransfer(addr, txbuf, txbytes, rxbuf, rxbytes);
+    }
+
+    if (rtn != RDY_OK)
+    {
+        simCount(SIM_COUNT_I2C_ERROR, 1);
+    }
+
+    return rtn;
+}
+
+/*===========================================================================*/
+/* RTC                                                                       */
+/*===========================================================================*/
+
+static int64_t rtcFromTrue(int64_t trueUs)
+{
+    return trueUs + trueUs * simCfg.rtcPpm / US_PER_S;
+}
+
+static int64_t trueFromRtc(int64_t rtcUs)
+{
+    return rtcUs * US_PER_S / (US_PER_S + simCfg.rtcPpm);
+}
+
+static uint32_t awakeUs(void)
+{
+    return chTimeNow() * (1000000 / CH_FREQUENCY);
+}
+
+int64_t simTrueUsNow(void)
+{
+    return sim->trueUs + awakeUs();
+}
+
+int64_t simRtcUsNow(void)
+{
+    return sim->rtcUs + rtcFromTrue(awakeUs());
+}
+
+/* Moves time on by rtcUs as counted by the RTC, from now. Only used once
+ * the wake is over. */
+void simRtcAdvance(int64_t rtcUs)
+{
+    sim->trueUs += awakeUs() + trueFromRtc(rtcUs);
+    sim->rtcUs += rtcFromTrue(awakeUs()) + rtcUs;
+}
+
+static uint32_t bcd(uint32_t value)
+{
+    return (value / 10) << 4 | (value % 10);
+}
+
+static uint32_t fromBcd(uint32_t reg, uint32_t shift, uint32_t mask)
+{
+    reg = (reg >> shift) & mask;
+
+    return (reg >> 4) * 10 + (reg & 0xF);
+}
+
+void rtcGetTime(RTCDriver * rtcp, RTCTime * timespec)
+{
+    clarityTimeDate td;
+
+    (void)rtcp;
+
+    rtcSecondsToTimeDate(simRtcUsNow() / US_PER_S, &td);
+
+    timespec->tv_date = bcd(td.date.year) << 16 | td.date.day << 13 |
+                        bcd(td.date.month) << 8 | bcd(td.date.date);
+    timespec->tv_time = bcd(td.time.hour) << 16 | bcd(td.time.minute) << 8 |
+                        bcd(td.time.second);
+    timespec->h12 = FALSE;
+}
+
+/* Setting the time also resets the sub-second counter */
+void rtcSetTime(RTCDriver * rtcp, const RTCTime * timespec)
+{
+    clarityTimeDate td;
+
+    (void)rtcp;
+
+    memset(&td, 0, sizeof(td));
+    td.date.year = fromBcd(timespec->tv_date, 16, 0xFF);
+    td.date.month = fromBcd(timespec->tv_date, 8, 0x1F);
+    td.date.date = fromBcd(timespec->tv_date, 0, 0x3F);
+    td.time.hour = fromBcd(timespec->tv_time, 16, 0x3F);
+    td.time.minute = fromBcd(timespec->tv_time, 8, 0x7F);
+    td.time.second = fromBcd(timespec->tv_time, 0, 0x7F);
+
+    sim->rtcUs = rtcTimeDateToSeconds(&td) * US_PER_S - rtcFromTrue(awakeUs());
+}
+
+void rtcSetAlarm(RTCDriver * rtcp, rtcalarm_t alarm,
+                 const RTCAlarm * alarmspec)
+{
+    (void)rtcp;
+
+    if (alarm != 0)
+    {
+        return;
+    }
+
+    if (alarmspec != NULL)
+    {
+        RTC->ALRMAR = alarmspec->tv_datetime;
+        RTC->CR |= RTC_CR_ALRAE | RTC_CR_ALRAIE;
+    }
+    else
+    {
+        RTC->CR &= ~(RTC_CR_ALRAE | RTC_CR_ALRAIE);
+    }
+}
+
+/* Seconds from nowS until alarm A next matches, or 0 if it never will. The
+ * hour, minute and second are always matched, the date unless MSK4 is set. */
+static uint32_t alarmSeconds(uint32_t nowS)
+{
+    uint32_t alarm = RTC->ALRMAR;
+    uint32_t timeOfDay = fromBcd(alarm, 16, 0x3F) * 3600 +
+                         fromBcd(alarm, 8, 0x7F) * 60 +
+                         fromBcd(alarm, 0, 0x7F);
+    uint32_t date = fromBcd(alarm, 24, 0x3F);
+    uint32_t candidate;
+    clarityTimeDate td;
+    uint32_t day;
+
+    for (day = 0; day <= 62; day++)
+    {
+        candidate = (nowS / DAY_S + day) * DAY_S + timeOfDay;
+
+        if (candidate <= nowS)
+        {
+            continue;
+        }
+
+        rtcSecondsToTimeDate(candidate, &td);
+
+        if ((alarm & 0x80000000) || td.date.date == date)
+        {
+            return candidate - nowS;
+        }
+    }
+
+    return 0;
+}
+
+/* Seconds until the wakeup timer expires, only ck_spre is supported. */
+static uint32_t wakeupSeconds(void)
+{
+    uint32_t clock = RTC->CR & RTC_CR_WUCKSEL;
+
+    if ((clock & RTC_CR_WUCKSEL_2) == 0)
+    {
+        fprintf(stderr, "sim: wakeup timer clock %lu not simulated\n",
+                (unsigned long)clock);
+        return 0;
+    }
+
+    return (RTC->WUTR & 0xFFFF) + 1 + ((clock & 0x2) ? 0x10000 : 0);
+}
+
+/* Standby if it has been set up, otherwise sleep mode, which nothing in the
+ * simulation wakes from so is a no-op. */
+void __WFI(void)
+{
+    int64_t nowUs = simRtcUsNow();
+    uint32_t alarm = 0;
+    uint32_t wakeup = 0;
+
+    if ((SCB->SCR & SCB_SCR_SLEEPDEEP_Msk) == 0 || 
+        (PWR->CR & PWR_CR_PDDS) == 0)
+    {
+        return;
+    }
+
+    if (RTC->CR & RTC_CR_ALRAE)
+    {
+        alarm = alarmSeconds(nowUs / US_PER_S);
+    }
+
+    if (RTC->CR & RTC_CR_WUTE)
+    {
+        wakeup = wakeupSeconds();
+    }
+
+    if (alarm != 0 && (wakeup == 0 || alarm <= wakeup))
+    {
+        /* The alarm matches on a whole second of the RTC */
+        RTC->ISR |= RTC_ISR_ALRAF;
+        simStandby(alarm * US_PER_S - nowUs % US_PER_S);
+    }
+    else if (wakeup != 0)
+    {
+        RTC->ISR |= RTC_ISR_WUTF;
+        simStandby(wakeup * US_PER_S);
+    }
+    else
+    {
+        fprintf(stderr, "sim: standby with no wake source\n");
+        exit(SIM_EXIT_NO_WAKE);
+    }
+}
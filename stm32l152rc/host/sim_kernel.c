@@ -0,0 +1,454 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Kernel stand-in. Every wait is on one condition variable under one lock,
+ * which is also the lock chSysLock() takes. Mutexes are owned and chained
+ * like ChibiOS's so chMtxUnlock() releases the most recent.
+ *
+ * Time is virtual: chThdSleep() moves the sleeping thread's clock on and
+ * returns, and chTimeNow() is the furthest any thread has got. Timed waits
+ * really wait, for their timeout divided by the configured speedup, so a
+ * wake never sits idle but a thread that is never signalled still times out.
+ * While the HTTP server is being given time to serve, sleeps are scaled the
+ * same way so the main loop doesn't spin. */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+
+static pthread_mutex_t kernelLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kernelCond;
+static systime_t systemTime;
+static Thread mainThread;
+static stkalign_t mainStack[0x400 / sizeof(stkalign_t)];   /* Process stack */
+static Thread * registryNewest;
+static __thread Thread * currentThread;
+
+static void kernelLockAcquire(void)
+{
+    pthread_mutex_lock(&kernelLock);
+}
+
+static void kernelLockRelease(void)
+{
+    pthread_mutex_unlock(&kernelLock);
+}
+
+/* Brings the thread up to the system time, or the system time up to the
+ * thread, after it has been blocked. Called with the kernel lock held. */
+static void timeSync(Thread * tp)
+{
+    if (tp->p_vtime > systemTime)
+    {
+        systemTime = tp->p_vtime;
+    }
+    else
+    {
+        tp->p_vtime = systemTime;
+    }
+}
+
+static void realDelay(systime_t time, struct timespec * ts)
+{
+    uint64_t ns = (uint64_t)time * (1000000000 / CH_FREQUENCY) /
+                  (simCfg.speedup == 0 ? 1 : simCfg.speedup);
+
+    ts->tv_sec = ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+/* An idle thread's context frame sits at the top of its stack, which also
+ * ends the fill. */
+static void stackFill(void * stack, size_t size)
+{
+    memset(stack, CH_STACK_FILL_VALUE, size - sizeof(stkalign_t));
+    memset((uint8_t *)stack + size - sizeof(stkalign_t), 0, sizeof(stkalign_t));
+}
+
+void simKernelBoot(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&kernelCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    memset(&mainThread, 0, sizeof(mainThread));
+    mainThread.p_prio = NORMALPRIO;
+    mainThread.p_pthread = pthread_self();
+    mainThread.p_stklimit = mainStack;
+    stackFill(mainStack, sizeof(mainStack));
+    currentThread = &mainThread;
+    registryNewest = &mainThread;
+    systemTime = 0;
+}
+
+void chSysInit(void)
+{
+    chRegSetThreadName("main");
+}
+
+void chSysLock(void)
+{
+    kernelLockAcquire();
+}
+
+void chSysUnlock(void)
+{
+    kernelLockRelease();
+}
+
+systime_t chTimeNow(void)
+{
+    systime_t now;
+
+    kernelLockAcquire();
+    now = systemTime;
+    kernelLockRelease();
+
+    return now;
+}
+
+/*===========================================================================*/
+/* Threads                                                                   */
+/*===========================================================================*/
+
+Thread * chThdSelf(void)
+{
+    return currentThread;
+}
+
+static void * threadStart(void * arg)
+{
+    Thread * tp = arg;
+
+    currentThread = tp;
+    chThdExit(tp->p_func(tp->p_arg));
+
+    return NULL;
+}
+
+Thread * chThdCreateStatic(void * wsp, size_t size, tprio_t prio,
+                           tfunc_t pf, void * arg)
+{
+    Thread * tp = wsp;
+
+    if (size < sizeof(Thread))
+    {
+        fprintf(stderr, "sim: working area too small for a thread\n");
+        abort();
+    }
+
+    memset(tp, 0, sizeof(*tp));
+    tp->p_stklimit = (stkalign_t *)(tp + 1);
+    stackFill(tp->p_stklimit, (uint8_t *)wsp + size - (uint8_t *)(tp + 1));
+    tp->p_prio = prio;
+    tp->p_func = pf;
+    tp->p_arg = arg;
+
+    kernelLockAcquire();
+    timeSync(currentThread);
+    tp->p_vtime = currentThread->p_vtime;
+    tp->p_older = registryNewest;
+    registryNewest->p_newer = tp;
+    registryNewest = tp;
+    kernelLockRelease();
+
+    if (pthread_create(&tp->p_pthread, NULL, threadStart, tp) != 0)
+    {
+        fprintf(stderr, "sim: pthread_create failed\n");
+        abort();
+    }
+
+    return tp;
+}
+
+void chThdExit(msg_t msg)
+{
+    Thread * tp = currentThread;
+
+    kernelLockAcquire();
+    tp->p_exitcode = msg;
+    tp->p_state = THD_STATE_FINAL;
+    timeSync(tp);
+    kernelLockRelease();
+
+    pthread_exit(NULL);
+}
+
+msg_t chThdWait(Thread * tp)
+{
+    pthread_join(tp->p_pthread, NULL);
+
+    kernelLockAcquire();
+
+    if (tp->p_older != NULL)
+    {
+        tp->p_older->p_newer = tp->p_newer;
+    }
+
+    if (tp->p_newer != NULL)
+    {
+        tp->p_newer->p_older = tp->p_older;
+    }
+    else
+    {
+        registryNewest = tp->p_older;
+    }
+
+    timeSync(currentThread);
+    kernelLockRelease();
+
+    return tp->p_exitcode;
+}
+
+void chThdSleep(systime_t time)
+{
+    struct timespec ts;
+
+    kernelLockAcquire();
+    timeSync(currentThread);
+    currentThread->p_vtime += time;
+    timeSync(currentThread);
+    kernelLockRelease();
+
+    if (simCfg.serveMs > 0)
+    {
+        realDelay(time, &ts);
+        nanosleep(&ts, NULL);
+    }
+    else
+    {
+        sched_yield();
+    }
+}
+
+void chThdYield(void)
+{
+    sched_yield();
+}
+
+/* Host CPU time stands in for the ticks a thread has run for */
+static Thread * cpuTimeRefresh(Thread * tp)
+{
+    struct timespec ts;
+    clockid_t clock;
+
+    if (tp != NULL && tp->p_state != THD_STATE_FINAL &&
+        pthread_getcpuclockid(tp->p_pthread, &clock) == 0 &&
+        clock_gettime(clock, &ts) == 0)
+    {
+        tp->p_time = ts.tv_sec * CH_FREQUENCY + 
+                     ts.tv_nsec / (1000000000 / CH_FREQUENCY);
+    }
+
+    return tp;
+}
+
+Thread * chRegFirstThread(void)
+{
+    return cpuTimeRefresh(&mainThread);
+}
+
+Thread * chRegNextThread(Thread * tp)
+{
+    Thread * next;
+
+    kernelLockAcquire();
+    next = cpuTimeRefresh(tp->p_newer);
+    kernelLockRelease();
+
+    return next;
+}
+
+/*===========================================================================*/
+/* Mutexes and semaphores                                                    */
+/*===========================================================================*/
+
+void chMtxInit(Mutex * mp)
+{
+    mp->m_owner = NULL;
+    mp->m_next = NULL;
+}
+
+void chMtxLock(Mutex * mp)
+{
+    Thread * tp = currentThread;
+
+    kernelLockAcquire();
+
+    while (mp->m_owner != NULL)
+    {
+        if (mp->m_owner == tp)
+        {
+            fprintf(stderr, "sim: mutex locked twice by %s\n",
+                    tp->p_name != NULL ? tp->p_name : "?");
+            abort();
+        }
+
+        pthread_cond_wait(&kernelCond, &kernelLock);
+    }
+
+    mp->m_owner = tp;
+    mp->m_next = tp->p_mtxlist;
+    tp->p_mtxlist = mp;
+    timeSync(tp);
+
+    kernelLockRelease();
+}
+
+Mutex * chMtxUnlock(void)
+{
+    Thread * tp = currentThread;
+    Mutex * mp;
+
+    kernelLockAcquire();
+
+    if ((mp = tp->p_mtxlist) == NULL)
+    {
+        fprintf(stderr, "sim: chMtxUnlock() with no mutex owned\n");
+        abort();
+    }
+
+    tp->p_mtxlist = mp->m_next;
+    mp->m_owner = NULL;
+    mp->m_next = NULL;
+    pthread_cond_broadcast(&kernelCond);
+
+    kernelLockRelease();
+
+    return mp;
+}
+
+void chBSemInit(BinarySemaphore * bsp, bool_t taken)
+{
+    bsp->bs_taken = taken;
+}
+
+msg_t chBSemWait(BinarySemaphore * bsp)
+{
+    return chBSemWaitTimeout(bsp, TIME_INFINITE);
+}
+
+msg_t chBSemWaitTimeout(BinarySemaphore * bsp, systime_t time)
+{
+    Thread * tp = currentThread;
+    struct timespec deadline;
+    struct timespec delay;
+
+    kernelLockAcquire();
+
+    if (bsp->bs_taken && time != TIME_IMMEDIATE && time != TIME_INFINITE)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        realDelay(time, &delay);
+        deadline.tv_sec += delay.tv_sec;
+        deadline.tv_nsec += delay.tv_nsec;
+
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    while (bsp->bs_taken)
+    {
+        int rtn = 0;
+
+        if (time == TIME_IMMEDIATE)
+        {
+            rtn = ETIMEDOUT;
+        }
+        else if (time == TIME_INFINITE)
+        {
+            pthread_cond_wait(&kernelCond, &kernelLock);
+        }
+        else
+        {
+            rtn = pthread_cond_timedwait(&kernelCond, &kernelLock, &deadline);
+        }
+
+        if (rtn == ETIMEDOUT && bsp->bs_taken)
+        {
+            if (time != TIME_IMMEDIATE)
+            {
+                timeSync(tp);
+                tp->p_vtime += time;
+                timeSync(tp);
+            }
+
+            kernelLockRelease();
+            return RDY_TIMEOUT;
+        }
+    }
+
+    bsp->bs_taken = TRUE;
+    timeSync(tp);
+
+    kernelLockRelease();
+
+    return RDY_OK;
+}
+
+void chBSemSignal(BinarySemaphore * bsp)
+{
+    kernelLockAcquire();
+    bsp->bs_taken = FALSE;
+    pthread_cond_broadcast(&kernelCond);
+    kernelLockRelease();
+}
+
+void chBSemReset(BinarySemaphore * bsp, bool_t taken)
+{
+    kernelLockAcquire();
+    bsp->bs_taken = taken;
+    pthread_cond_broadcast(&kernelCond);
+    kernelLockRelease();
+}
+
+/* Nothing is allocated from the core or heap on the host */
+size_t chHeapStatus(void * heapp, size_t * sizep)
+{
+    (void)heapp;
+
+    if (sizep != NULL)
+    {
+        *sizep = 0;
+    }
+
+    return 0;
+}
+
+size_t chCoreStatus(void)
+{
+    return 0;
+}
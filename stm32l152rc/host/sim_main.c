@@ -0,0 +1,628 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Host simulation of the node's wake cycle. Each wake is a forked child that
+ * boots the firmware from main() and exits when it enters standby, leaving
+ * the backup domain, EEPROM and statistics behind in memory shared with this
+ * process. The time spent and the work done in each of the firmware's timing
+ * phases is accounted by wrapping timingPhaseStart() and timingPhaseEnd().
+ * schedulerWake() is wrapped to check each schedule fires when it is due. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "sim.h"
+
+/* As eeprom.c */
+#define EEPROM_BASE             0x08080000
+#define EEPROM_SIZE             0x2000
+#define EEPROM_WORDS            (EEPROM_SIZE / sizeof(uint32_t))
+
+#define UNIX_TO_2000_S          946684800LL
+
+/* How far a schedule may fire from when it is due. Time awake is taken off
+ * in whole seconds and the wakeup timer counts whole seconds. One that comes
+ * due while awake fires on the next wake, so may be late by the last wake's
+ * time awake as well. */
+#define SCHEDULE_EARLY_US       2000000LL
+#define SCHEDULE_LATE_US        2000000LL
+
+simState * sim;
+uint32_t simWake;
+uint64_t simWakeStartNs;
+int simSerialFd = -1;
+
+simConfig simCfg = {
+    .wakes = 1000,
+    .eepromPath = "node.eeprom",
+    .collectorIp = 0x7F000001,
+    .speedup = 1000,
+    .rtcPpm = 20,
+    .seed = 1
+};
+
+static const char * phaseNames[SIM_PHASES] = {
+    [TIMING_PHASE_HAL_INIT]     = "hal",
+    [TIMING_PHASE_CC3000_INIT]  = "cc3000",
+    [TIMING_PHASE_ASSOCIATE]    = "associate",
+    [TIMING_PHASE_SNTP]         = "sntp",
+    [TIMING_PHASE_POST_ERROR]   = "post_error",
+    [TIMING_PHASE_POST_TIMING]  = "post_timing",
+    [TIMING_PHASE_POST_SAMPLES] = "post_samples",
+    [TIMING_PHASE_SHUTDOWN]     = "shutdown",
+    [TIMING_PHASE_STANDBY]      = "standby",
+    [SIM_PHASE_WAKE]            = "wake"
+};
+
+static const char * countNames[SIM_COUNTS] = {
+    [SIM_COUNT_I2C]             = "i2c",
+    [SIM_COUNT_I2C_ERROR]       = "i2c err",
+    [SIM_COUNT_EEPROM_WORDS]    = "ee words",
+    [SIM_COUNT_TCP_CONNECT]     = "tcp conn",
+    [SIM_COUNT_HTTP_REQUEST]    = "http req",
+    [SIM_COUNT_HTTP_ERROR]      = "http err",
+    [SIM_COUNT_TX_BYTES]        = "tx B",
+    [SIM_COUNT_RX_BYTES]        = "rx B",
+    [SIM_COUNT_UDP]             = "udp",
+    [SIM_COUNT_DNS]             = "dns",
+    [SIM_COUNT_SNTP]            = "sntp",
+    [SIM_COUNT_HTTP_SERVED]     = "served"
+};
+
+static int64_t startTrueUs;
+
+/* Per wake, so only in the child */
+static uint64_t phaseStartNs[SIM_PHASES];
+static uint64_t phaseStartCounts[SIM_PHASES][SIM_COUNTS];
+static uint32_t phaseStartEeprom[SIM_PHASES][EEPROM_WORDS];
+
+int firmwareMain(void);
+void __real_timingPhaseStart(timingPhase phase);
+void __real_timingPhaseEnd(timingPhase phase);
+uint32_t __real_schedulerWake(const uint32_t * periods);
+
+void simCount(simCountId id, uint64_t n)
+{
+    __atomic_fetch_add(&sim->counters[id], n, __ATOMIC_RELAXED);
+}
+
+uint64_t simMonotonicNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*===========================================================================*/
+/* Phase accounting                                                          */
+/*===========================================================================*/
+
+static void phaseBegin(uint32_t phase)
+{
+    memcpy(phaseStartEeprom[phase], (void *)EEPROM_BASE, EEPROM_SIZE);
+    memcpy(phaseStartCounts[phase], sim->counters, sizeof(sim->counters));
+    phaseStartNs[phase] = simMonotonicNs();
+}
+
+/* EEPROM writes are found by comparison rather than counted as they
+ * happen, so the firmware's own writes needn't be intercepted. */
+static void phaseFinish(uint32_t phase)
+{
+    simPhaseStats * stats = &sim->phases[phase];
+    const uint32_t * eeprom = (const uint32_t *)EEPROM_BASE;
+    uint64_t ns = simMonotonicNs() - phaseStartNs[phase];
+    uint32_t i;
+
+    for (i = 0; i < EEPROM_WORDS; i++)
+    {
+        if (eeprom[i] != phaseStartEeprom[phase][i])
+        {
+            stats->work[SIM_COUNT_EEPROM_WORDS]++;
+        }
+    }
+
+    for (i = 0; i < SIM_COUNTS; i++)
+    {
+        stats->work[i] += sim->counters[i] - phaseStartCounts[phase][i];
+    }
+
+    stats->count++;
+    stats->totalNs += ns;
+
+    if (ns > stats->maxNs)
+    {
+        stats->maxNs = ns;
+    }
+}
+
+void __wrap_timingPhaseStart(timingPhase phase)
+{
+    phaseBegin(phase);
+    __real_timingPhaseStart(phase);
+}
+
+void __wrap_timingPhaseEnd(timingPhase phase)
+{
+    __real_timingPhaseEnd(phase);
+    phaseFinish(phase);
+}
+
+/*===========================================================================*/
+/* Schedules                                                                 */
+/*===========================================================================*/
+
+/* Each schedule that fired is checked against when it was due, then due a
+ * period later. A schedule first fires on the first boot. */
+uint32_t __wrap_schedulerWake(const uint32_t * periods)
+{
+    uint32_t fired = __real_schedulerWake(periods);
+    int64_t nowUs = simTrueUsNow();
+    int64_t offUs;
+    uint32_t id;
+
+    for (id = 0; id < SCHEDULES; id++)
+    {
+        if (SCHEDULE_FIRED(fired, id) == false)
+        {
+            continue;
+        }
+
+        if (sim->scheduleFires[id] != 0)
+        {
+            offUs = nowUs - sim->scheduleDueUs[id];
+
+            if (offUs < -SCHEDULE_EARLY_US ||
+                offUs > SCHEDULE_LATE_US + sim->lastAwakeUs)
+            {
+                fprintf(stderr, "sim: wake %u, schedule %u fired %+.3f s "
+                        "from when it was due\n", simWake, id, offUs / 1e6);
+                exit(SIM_EXIT_SCHEDULE);
+            }
+
+            if (offUs < sim->scheduleEarlyUs[id])
+            {
+                sim->scheduleEarlyUs[id] = offUs;
+            }
+
+            if (offUs > sim->scheduleLateUs[id])
+            {
+                sim->scheduleLateUs[id] = offUs;
+            }
+
+            /* Keeping to the period, as the scheduler does */
+            sim->scheduleDueUs[id] += periods[id] * 1000000LL;
+        }
+        else
+        {
+            sim->scheduleDueUs[id] = nowUs + periods[id] * 1000000LL;
+        }
+
+        sim->scheduleFires[id]++;
+    }
+
+    return fired;
+}
+
+/*===========================================================================*/
+/* Wakes                                                                     */
+/*===========================================================================*/
+
+/* Called from __WFI() with the time until the RTC wakes us. Whatever threads
+ * are still running go with the process, as they would with the core. Every
+ * resetEvery wakes the core is instead reset halfway through standby. The
+ * backup registers are kept, but the schedules can't know the time that
+ * passed and are due that much later. */
+void simStandby(int64_t rtcUs)
+{
+    uint32_t id;
+
+    phaseFinish(SIM_PHASE_WAKE);
+
+    sim->lastAwakeUs = simTrueUsNow() - sim->trueUs;
+
+    if (simCfg.resetEvery != 0 && (simWake + 1) % simCfg.resetEvery == 0)
+    {
+        rtcUs /= 2;
+        sim->standbySeconds = 0;
+        sim->resets++;
+
+        for (id = 0; id < SCHEDULES; id++)
+        {
+            sim->scheduleDueUs[id] += rtcUs;
+        }
+    }
+    else
+    {
+        sim->standbySeconds = (rtcUs + 999999) / 1000000;
+    }
+
+    simRtcAdvance(rtcUs);
+
+    fflush(stdout);
+    _exit(0);
+}
+
+static void runWake(void)
+{
+    simWakeStartNs = simMonotonicNs();
+
+    simKernelBoot();
+    simHalBoot();
+    phaseBegin(SIM_PHASE_WAKE);
+
+    firmwareMain();
+
+    fprintf(stderr, "sim: main() returned\n");
+    exit(SIM_EXIT_RETURNED);
+}
+
+static bool waitWake(pid_t pid)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            perror("sim: waitpid");
+            return false;
+        }
+    }
+
+    if (WIFSIGNALED(status))
+    {
+        fprintf(stderr, "sim: wake %u killed by signal %d (%s)\n",
+                simWake, WTERMSIG(status), strsignal(WTERMSIG(status)));
+        return false;
+    }
+
+    if (WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "sim: wake %u failed with status %d\n",
+                simWake, WEXITSTATUS(status));
+        return false;
+    }
+
+    return true;
+}
+
+/*===========================================================================*/
+/* Setup and report                                                          */
+/*===========================================================================*/
+
+static bool mapEeprom(void)
+{
+    void * eeprom;
+    int fd;
+
+    if ((fd = open(simCfg.eepromPath, O_RDWR | O_CREAT, 0644)) < 0)
+    {
+        perror(simCfg.eepromPath);
+        return false;
+    }
+
+    /* Erased EEPROM reads as zero, as does a file extended by truncation */
+    if ((simCfg.wipeEeprom && ftruncate(fd, 0) != 0) ||
+        ftruncate(fd, EEPROM_SIZE) != 0)
+    {
+        perror(simCfg.eepromPath);
+        close(fd);
+        return false;
+    }
+
+    eeprom = mmap((void *)EEPROM_BASE, EEPROM_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+
+    if (eeprom != (void *)EEPROM_BASE)
+    {
+        fprintf(stderr, "sim: can't map the EEPROM at 0x%08X\n", EEPROM_BASE);
+        return false;
+    }
+
+    return true;
+}
+
+static bool mapState(void)
+{
+    struct timespec ts;
+
+    sim = mmap(NULL, sizeof(*sim), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (sim == MAP_FAILED)
+    {
+        perror("sim: mmap");
+        return false;
+    }
+
+    /* The RTC starts at 2000-01-01 as after a backup domain reset, the
+     * reference time is now */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(sim, 0, sizeof(*sim));
+    sim->trueUs = (ts.tv_sec - UNIX_TO_2000_S) * 1000000LL + 
+                  ts.tv_nsec / 1000;
+
+    return true;
+}
+
+static void report(uint64_t elapsedNs, uint32_t failures)
+{
+    static const simCountId columns[] = {
+        SIM_COUNT_I2C, SIM_COUNT_EEPROM_WORDS, SIM_COUNT_TCP_CONNECT,
+        SIM_COUNT_HTTP_REQUEST, SIM_COUNT_TX_BYTES, SIM_COUNT_RX_BYTES,
+        SIM_COUNT_UDP, SIM_COUNT_DNS, SIM_COUNT_SNTP, SIM_COUNT_HTTP_SERVED
+    };
+    const simPhaseStats * stats;
+    double seconds = elapsedNs / 1e9;
+    uint32_t phase;
+    uint32_t i;
+
+    printf("%u wakes in %.3f s, %.1f wakes/s, %u failed\n",
+           simWake, seconds, seconds > 0 ? simWake / seconds : 0.0, failures);
+
+    printf("\n%-13s %8s %10s %10s", "phase", "runs", "mean us", "max us");
+
+    for (i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
+    {
+        printf(" %9s", countNames[columns[i]]);
+    }
+
+    printf("\n");
+
+    for (phase = 0; phase < SIM_PHASES; phase++)
+    {
+        stats = &sim->phases[phase];
+
+        if (stats->count == 0)
+        {
+            continue;
+        }
+
+        printf("%-13s %8llu %10.1f %10.1f", phaseNames[phase],
+               (unsigned long long)stats->count,
+               stats->totalNs / 1e3 / stats->count, stats->maxNs / 1e3);
+
+        /* Work is per run of the phase */
+        for (i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
+        {
+            printf(" %9.2f", (double)stats->work[columns[i]] / stats->count);
+        }
+
+        printf("\n");
+    }
+
+    printf("\n%llu of %llu I2C transfers failed, "
+           "%llu of %llu HTTP requests failed\n",
+           (unsigned long long)sim->counters[SIM_COUNT_I2C_ERROR],
+           (unsigned long long)sim->counters[SIM_COUNT_I2C],
+           (unsigned long long)sim->counters[SIM_COUNT_HTTP_ERROR],
+           (unsigned long long)sim->counters[SIM_COUNT_HTTP_REQUEST]);
+
+    printf("%.2f days simulated, the RTC counter is %+.3f s from the "
+           "reference time\n",
+           (sim->trueUs - startTrueUs) / 86400e6,
+           (sim->rtcUs - sim->trueUs) / 1e6);
+
+    if (sim->resets != 0)
+    {
+        printf("%u boots were a reset during standby\n", sim->resets);
+    }
+
+    for (i = 0; i < SCHEDULES; i++)
+    {
+        if (sim->scheduleFires[i] != 0)
+        {
+            printf("Schedule %u fired %llu times, %+.3f to %+.3f s from "
+                   "when it was due\n", i,
+                   (unsigned long long)sim->scheduleFires[i],
+                   sim->scheduleEarlyUs[i] / 1e6,
+                   sim->scheduleLateUs[i] / 1e6);
+        }
+    }
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n wakes      Number of wakes to run (%u)\n"
+            "  -e file       EEPROM image, created if missing (%s)\n"
+            "  -w            Erase the EEPROM image first\n"
+            "  -l file       Append the serial port output to file, decode\n"
+            "                it with utils/log_decode.py\n"
+            "  -c ip         Address every host name resolves to\n"
+            "  -p port       Send HTTP to this port instead\n"
+            "  -u port       Send UDP to this port instead\n"
+            "  -s port       Serve the firmware's resources on this port\n"
+            "  -t ms         Real time each wake serves before the button\n"
+            "                is pressed (0)\n"
+            "  -x factor     Virtual time over real time for timeouts (%u)\n"
+            "  -d ppm        RTC crystal error (%d)\n"
+            "  -i permille   I2C transfer failure rate (0)\n"
+            "  -b wakes      Reset halfway through standby after every\n"
+            "                this many wakes (0, never)\n"
+            "  -r seed       Seed for sensor noise and I2C failures (%u)\n",
+            name, simCfg.wakes, simCfg.eepromPath, simCfg.speedup,
+            simCfg.rtcPpm, simCfg.seed);
+}
+
+static bool parsePort(const char * str, uint16_t * port)
+{
+    char * end;
+    unsigned long value = strtoul(str, &end, 10);
+
+    if (*end != '\0' || value > 0xFFFF)
+    {
+        return false;
+    }
+
+    *port = value;
+
+    return true;
+}
+
+static bool parseArgs(int argc, char * argv[])
+{
+    struct in_addr addr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:e:wl:c:p:u:s:t:x:d:i:b:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                simCfg.wakes = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                simCfg.eepromPath = optarg;
+                break;
+            case 'w':
+                simCfg.wipeEeprom = true;
+                break;
+            case 'l':
+                simCfg.serialPath = optarg;
+                break;
+            case 'c':
+                if (inet_pton(AF_INET, optarg, &addr) != 1)
+                {
+                    return false;
+                }
+                simCfg.collectorIp = ntohl(addr.s_addr);
+                break;
+            case 'p':
+                if (parsePort(optarg, &simCfg.tcpPort) == false)
+                {
+                    return false;
+                }
+                break;
+            case 'u':
+                if (parsePort(optarg, &simCfg.udpPort) == false)
+                {
+                    return false;
+                }
+                break;
+            case 's':
+                if (parsePort(optarg, &simCfg.httpPort) == false)
+                {
+                    return false;
+                }
+                break;
+            case 't':
+                simCfg.serveMs = strtoul(optarg, NULL, 10);
+                break;
+            case 'x':
+                simCfg.speedup = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                simCfg.rtcPpm = strtol(optarg, NULL, 10);
+                break;
+            case 'i':
+                simCfg.i2cErrorPerMille = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                simCfg.resetEvery = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                simCfg.seed = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return optind == argc && simCfg.speedup != 0;
+}
+
+int main(int argc, char * argv[])
+{
+    uint64_t startNs;
+    uint32_t failures = 0;
+    pid_t pid;
+
+    if (parseArgs(argc, argv) == false)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (mapState() == false || mapEeprom() == false)
+    {
+        return 1;
+    }
+
+    if (simCfg.serialPath != NULL &&
+        (simSerialFd = open(simCfg.serialPath, 
+                            O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+    {
+        perror(simCfg.serialPath);
+        return 1;
+    }
+
+    /* A collector closing a kept alive connection shouldn't kill a wake */
+    signal(SIGPIPE, SIG_IGN);
+
+    startTrueUs = sim->trueUs;
+    startNs = simMonotonicNs();
+
+    for (simWake = 0; simWake < simCfg.wakes; simWake++)
+    {
+        fflush(stdout);
+        fflush(stderr);
+
+        if ((pid = fork()) < 0)
+        {
+            perror("sim: fork");
+            return 1;
+        }
+
+        if (pid == 0)
+        {
+            runWake();
+        }
+
+        /* Later wakes depend on this one having gone to standby */
+        if (waitWake(pid) == false)
+        {
+            failures++;
+            break;
+        }
+    }
+
+    report(simMonotonicNs() - startNs, failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Register models of the sensors on I2C2. Readings follow a daily cycle in
+ * the reference time, with a little noise, and are only available once the
+ * part has had its conversion time. Both parts start each wake in their
+ * reset state. */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "tsl2561.h"
+#include "mpl3115a2.h"
+
+#define DAY_S                   (24.0 * 60 * 60)
+
+/* TSL2561 */
+#define TSL_COMMAND             0x80
+#define TSL_REG_MASK            0x0F
+#define TSL_REG_CONTROL         0x00
+#define TSL_REG_TIMING          0x01
+#define TSL_REG_ID              0x0A
+#define TSL_REG_DATA0           0x0C
+#define TSL_REG_DATA1           0x0E
+#define TSL_POWER_MASK          0x03
+#define TSL_POWER_UP            0x03
+#define TSL_ID_T                0x50
+
+/* MPL3115A2 */
+#define MPL_REG_STATUS          0x00
+#define MPL_REG_OUT_P           0x01
+#define MPL_REG_OUT_T           0x04
+#define MPL_REG_WHO_AM_I        0x0C
+#define MPL_REG_CTRL1           0x26
+#define MPL_REGS                0x2E
+#define MPL_CTRL1_OST           0x02
+#define MPL_CTRL1_OS_SHIFT      3
+#define MPL_CTRL1_OS_MASK       0x07
+#define MPL_STATUS_PTDR         0x0E
+#define MPL_WHO_AM_I            0xC4
+
+static struct {
+    uint8_t regs[16];
+    systime_t poweredAt;
+} tsl;
+
+static struct {
+    uint8_t regs[MPL_REGS];
+    systime_t oneShotAt;
+} mpl = {
+    .regs = {[MPL_REG_WHO_AM_I] = MPL_WHO_AM_I}
+};
+
+static unsigned int noiseSeed;
+
+/* Uniform in [-1, 1] */
+static double noise(void)
+{
+    if (noiseSeed == 0)
+    {
+        noiseSeed = simCfg.seed ^ (simWake * 2246822519U) ^ 1;
+    }
+
+    return rand_r(&noiseSeed) / (RAND_MAX / 2.0) - 1;
+}
+
+static double daySine(double phase)
+{
+    double day = fmod(simTrueUsNow() / 1e6, DAY_S) / DAY_S;
+
+    return sin(2 * M_PI * (day - phase));
+}
+
+static double environmentLux(void)
+{
+    double daylight = daySine(0.25);
+
+    return (daylight > 0 ? 1000 * daylight : 0) + 5 + 2 * noise();
+}
+
+static double environmentCelsius(void)
+{
+    return 18 + 4 * daySine(0.375) + 0.05 * noise();
+}
+
+static double environmentPascals(void)
+{
+    double days = simTrueUsNow() / 1e6 / DAY_S;
+
+    return 101325 + 400 * sin(2 * M_PI * days / 3) + 10 * noise();
+}
+
+/*===========================================================================*/
+/* TSL2561                                                                   */
+/*===========================================================================*/
+
+static uint32_t tslIntegrationMs(void)
+{
+    static const uint32_t ms[] = {14, 101, 402, 402};
+
+    return ms[tsl.regs[TSL_REG_TIMING] & 0x3];
+}
+
+/* Channel counts that give roughly lux with a CH1/CH0 ratio of 0.2 */
+static void tslLatch(void)
+{
+    uint32_t ch0 = 0;
+    uint32_t ch1 = 0;
+
+    if ((tsl.regs[TSL_REG_CONTROL] & TSL_POWER_MASK) == TSL_POWER_UP &&
+        chTimeNow() - tsl.poweredAt >= tslIntegrationMs())
+    {
+        ch0 = environmentLux() * 10000 / 237;
+        ch0 = ch0 > 0xFFFF ? 0xFFFF : ch0;
+        ch1 = ch0 / 5;
+    }
+
+    tsl.regs[TSL_REG_DATA0] = ch0;
+    tsl.regs[TSL_REG_DATA0 + 1] = ch0 >> 8;
+    tsl.regs[TSL_REG_DATA1] = ch1;
+    tsl.regs[TSL_REG_DATA1 + 1] = ch1 >> 8;
+}
+
+static msg_t tslTransfer(const uint8_t * tx, size_t txBytes,
+                         uint8_t * rx, size_t rxBytes)
+{
+    uint32_t reg;
+    size_t i;
+
+    /* Everything goes through the command register */
+    if (txBytes == 0 || (tx[0] & TSL_COMMAND) == 0)
+    {
+        return RDY_RESET;
+    }
+
+    reg = tx[0] & TSL_REG_MASK;
+
+    if (txBytes == 2)
+    {
+        if (reg == TSL_REG_CONTROL &&
+            (tx[1] & TSL_POWER_MASK) == TSL_POWER_UP &&
+            (tsl.regs[reg] & TSL_POWER_MASK) != TSL_POWER_UP)
+        {
+            tsl.poweredAt = chTimeNow();
+        }
+
+        tsl.regs[reg] = tx[1];
+    }
+    else if (txBytes > 2)
+    {
+        return RDY_RESET;
+    }
+
+    if (rxBytes > 0)
+    {
+        tsl.regs[TSL_REG_ID] = TSL_ID_T;
+        tslLatch();
+
+        for (i = 0; i < rxBytes; i++)
+        {
+            rx[i] = tsl.regs[(reg + i) & TSL_REG_MASK];
+        }
+    }
+
+    return RDY_OK;
+}
+
+/*===========================================================================*/
+/* MPL3115A2                                                                 */
+/*===========================================================================*/
+
+/* Oversampling of 2^OS takes about 2^OS * 4 + 2 ms */
+static uint32_t mplConversionMs(void)
+{
+    uint32_t os = (mpl.regs[MPL_REG_CTRL1] >> MPL_CTRL1_OS_SHIFT) & 
+                  MPL_CTRL1_OS_MASK;
+
+    return (4U << os) + 2;
+}
+
+/* Completes a one shot conversion once it has had time to run. Pressure is
+ * unsigned Q18.2 Pa and temperature signed Q8.4 Celsius, left aligned. */
+static void mplUpdate(void)
+{
+    uint32_t pressure;
+    int16_t temperature;
+
+    if ((mpl.regs[MPL_REG_CTRL1] & MPL_CTRL1_OST) == 0 ||
+        chTimeNow() - mpl.oneShotAt < mplConversionMs())
+    {
+        return;
+    }
+
+    pressure = (uint32_t)lround(environmentPascals() * 4) << 4;
+    temperature = (int16_t)(lround(environmentCelsius() * 16) << 4);
+
+    mpl.regs[MPL_REG_OUT_P] = pressure >> 16;
+    mpl.regs[MPL_REG_OUT_P + 1] = pressure >> 8;
+    mpl.regs[MPL_REG_OUT_P + 2] = pressure & 0xF0;
+    mpl.regs[MPL_REG_OUT_T] = (uint16_t)temperature >> 8;
+    mpl.regs[MPL_REG_OUT_T + 1] = temperature & 0xF0;
+    mpl.regs[MPL_REG_STATUS] = MPL_STATUS_PTDR;
+    mpl.regs[MPL_REG_CTRL1] &= ~MPL_CTRL1_OST;
+}
+
+static msg_t mplTransfer(const uint8_t * tx, size_t txBytes,
+                         uint8_t * rx, size_t rxBytes)
+{
+    uint32_t reg;
+    size_t i;
+
+    if (txBytes == 0 || tx[0] >= MPL_REGS)
+    {
+        return RDY_RESET;
+    }
+
+    reg = tx[0];
+    mplUpdate();
+
+    for (i = 1; i < txBytes && reg + i - 1 < MPL_REGS; i++)
+    {
+        if (reg + i - 1 == MPL_REG_CTRL1 && (tx[i] & MPL_CTRL1_OST) &&
+            (mpl.regs[MPL_REG_CTRL1] & MPL_CTRL1_OST) == 0)
+        {
+            mpl.oneShotAt = chTimeNow();
+        }
+
+        mpl.regs[reg + i - 1] = tx[i];
+    }
+
+    for (i = 0; i < rxBytes; i++)
+    {
+        rx[i] = mpl.regs[(reg + i) % MPL_REGS];
+    }
+
+    return RDY_OK;
+}
+
+msg_t simI2cTransfer(i2caddr_t addr, const uint8_t * tx, size_t txBytes,
+                     uint8_t * rx, size_t rxBytes)
+{
+    switch (addr)
+    {
+        case TSL2561_ADDR_FLOAT:
+            return tslTransfer(tx, txBytes, rx, rxBytes);
+
+        case MPL3115A2_DEFAULT_ADDR:
+            return mplTransfer(tx, txBytes, rx, rxBytes);
+
+        default:
+            return RDY_RESET;
+    }
+}
@@ -25,130 +25,81 @@
 *******************************************************************************/
 #include "fyp.h"
 #include "string.h"
-#include "mpl3115a2.h"
-#include "tsl2561.h"
 
-#define LUX_STRING_SIZE         7 /* "xxx lx" + NULL*/
-#define TEMPERATURE_STRING_SIZE 9  /* "xxx.xx K" + NULL */
-#define PRESSURE_STRING_SIZE    11 /* "101.33 kPa" + NULL*/
-#define HTTP_RESPONSE_SIZE      100
-#define CELSIUS_TO_KELVIN       273.15
-
-char httpResponse[HTTP_RESPONSE_SIZE]; /* XXX not thread safe */
+#define LOG_FILE                LOG_FILE_HTTP_SENSORS
 
-I2CConfig i2cConfig;
-i2cflags_t errorFlags;
+#define LUX_STRING_SIZE         FIXED_POINT_LUX_SIZE
+#define TEMPERATURE_STRING_SIZE FIXED_POINT_KELVIN_SIZE
+#define PRESSURE_STRING_SIZE    FIXED_POINT_KPA_SIZE
 
-void initialiseSensorHw(void)
+#define HTTP_RESPONSE_SIZE      100
+#define SAMPLE_LOG_SAMPLES_PER_POST 12
+#define SAMPLE_LOG_POST_SIZE    (SAMPLE_LOG_SAMPLES_PER_POST * \
+                                 MEASUREMENT_RECORD_SIZE * 3 + 160)
+#define BATCH_BODY_SIZE         (sizeof("temperature \n") + TEMPERATURE_STRING_SIZE + \
+                                 sizeof("pressure \n") + PRESSURE_STRING_SIZE +    \
+                                 sizeof("lux \n") + LUX_STRING_SIZE)
+
+/* Sends value as a text/plain response. Requests are served one at a time on
+ * clarity's server thread, so the response is built on that thread's stack
+ * and nothing is shared between handlers. */
+static uint32_t httpSendValue(clarityConnectionInformation * conn,
+                              const char * value)
 {
-    /* I2C for sensors */
-    palSetPadMode(I2C_PORT, I2C_SDA, PAL_MODE_ALTERNATE(4) | 
-                                     PAL_STM32_OTYPE_OPENDRAIN |
-                                     PAL_STM32_OSPEED_LOWEST);
-    palSetPadMode(I2C_PORT, I2C_SCL, PAL_MODE_ALTERNATE(4) | 
-                                     PAL_STM32_OTYPE_OPENDRAIN |
-                                     PAL_STM32_OSPEED_LOWEST);
-
-    i2cObjectInit(&I2C_DRIVER);
-
-    i2cConfig.op_mode = OPMODE_I2C;
-    i2cConfig.duty_cycle = STD_DUTY_CYCLE;
-    i2cConfig.clock_speed = 100000;
-}
+    char response[HTTP_RESPONSE_SIZE];
+    int32_t responseSize;
 
-void deinitialiseSensorHw(void)
-{
-    /* I2C for sensors */
-    palSetPadMode(I2C_PORT, I2C_SDA, PAL_MODE_UNCONNECTED);
-    palSetPadMode(I2C_PORT, I2C_SCL, PAL_MODE_UNCONNECTED);
+    responseSize = clarityHttpBuildResponseTextPlain(response,
+                                                     sizeof(response),
+                                                     200, "OK",
+                                                     value);
+
+    if (responseSize < 0 ||
+        clarityHttpServerSendInCb(conn, response, responseSize) != 
+            (uint32_t)responseSize)
+    {
+        PRINT("Send failed.");
+        return 1;
+    }
 
+    return 0;
 }
 
-static uint32_t getLuxStr(char *luxString)
+static uint32_t getLuxStr(const sensorSample * sample, char *luxString)
 {
-    uint16_t lux = 0;
-
-    spiAcquireBus(&CC3000_SPI_DRIVER);
-    i2cAcquireBus(&I2C_DRIVER);
-    i2cStart(&I2C_DRIVER, &i2cConfig);
-
-    if (RDY_OK != (tslReadLuxConvertSleep(&I2C_DRIVER,
-                                          TSL2561_ADDR_FLOAT,
-                                          &lux)))
+    if (sample->luxValid != true ||
+        fixedPointFormat(luxString, LUX_STRING_SIZE, sample->lux,
+                         UNIT_CODE_LUX) < 0)
     {
-        PRINT("Error", NULL);
+        return 1;
     }
 
-    i2cStop(&I2C_DRIVER);
-    i2cReleaseBus(&I2C_DRIVER);
-    spiReleaseBus(&CC3000_SPI_DRIVER);
- 
-    snprintf(luxString, LUX_STRING_SIZE, "%d lx", lux); 
-    luxString[LUX_STRING_SIZE-1] = 0;
-
     return 0;
 }
 
-static uint32_t getTemperatureStr(char * temperatureStr)
+static uint32_t getTemperatureStr(const sensorSample * sample,
+                                  char * temperatureStr)
 {
-
-    float temperature = 0;
-    float pressure = 0;
-
-    spiAcquireBus(&CC3000_SPI_DRIVER);
-    i2cAcquireBus(&I2C_DRIVER);
-    i2cStart(&I2C_DRIVER, &i2cConfig);
-
-    if (RDY_OK != mplOneShotReadBarometer(&I2C_DRIVER,
-                                          MPL3115A2_DEFAULT_ADDR,
-                                          &pressure, 
-                                          &temperature))
+    if (sample->barometerValid != true ||
+        fixedPointFormat(temperatureStr, TEMPERATURE_STRING_SIZE,
+                         sample->temperature, UNIT_CODE_KELVIN_X100) < 0)
     {
         return 1;
     }
 
-
-    i2cStop(&I2C_DRIVER);
-    i2cReleaseBus(&I2C_DRIVER);
-    spiReleaseBus(&CC3000_SPI_DRIVER);
- 
-    temperature += CELSIUS_TO_KELVIN;
-
-    snprintf(temperatureStr, TEMPERATURE_STRING_SIZE, "%.2f K", temperature); 
-    temperatureStr[TEMPERATURE_STRING_SIZE-1] = 0;
-
-
     return 0;
 }
 
 
-static uint32_t getPressureStr(char * pressureStr)
+static uint32_t getPressureStr(const sensorSample * sample, char * pressureStr)
 {
-
-    float pressure;
-    float temperature;
-
-    spiAcquireBus(&CC3000_SPI_DRIVER);
-    i2cAcquireBus(&I2C_DRIVER);
-    i2cStart(&I2C_DRIVER, &i2cConfig);
-
-    if (RDY_OK != mplOneShotReadBarometer(&I2C_DRIVER,
-                                          MPL3115A2_DEFAULT_ADDR,
-                                          &pressure, 
-                                          &temperature))
+    if (sample->barometerValid != true ||
+        fixedPointFormat(pressureStr, PRESSURE_STRING_SIZE,
+                         sample->pressure, UNIT_CODE_KPA_X100) < 0)
     {
         return 1;
     }
 
-    i2cStop(&I2C_DRIVER);
-    i2cReleaseBus(&I2C_DRIVER);
-    spiReleaseBus(&CC3000_SPI_DRIVER);
- 
-    pressure /= 1000; /* kPa */
-
-    snprintf(pressureStr, PRESSURE_STRING_SIZE, "%.2f kPa", pressure); 
-    pressureStr[PRESSURE_STRING_SIZE-1] = 0;
-
     return 0;
 }
 
@@ -157,51 +108,31 @@ uint32_t httpGetPressure(const clarityHttpRequestInformation * info,
                                 clarityConnectionInformation * conn)
 {
     char pressureStr[PRESSURE_STRING_SIZE]; 
-    int32_t httpResponseSize;
+    sensorSample sample;
     (void)info;
 
-    getPressureStr(pressureStr);
+    memset(pressureStr, 0, sizeof(pressureStr));
 
-    httpResponseSize = clarityHttpBuildResponseTextPlain(httpResponse,
-                                                 sizeof(httpResponse),
-                                                 200, "OK",
-                                                 pressureStr);
+    sensorSampleGet(&sample);
+    getPressureStr(&sample, pressureStr);
 
-    if ((clarityHttpServerSendInCb(conn, httpResponse, httpResponseSize)) 
-              != httpResponseSize)
-    {
-        PRINT("Send failed.", NULL);
-        while(1);
-        return 1;
-    }
-
-    return 0;
+    return httpSendValue(conn, pressureStr);
 }
 
 uint32_t httpGetTemperature(const clarityHttpRequestInformation * info, 
                                    clarityConnectionInformation * conn)
 {
     (void)info;
-    (void)conn;
 
     char temperatureStr[TEMPERATURE_STRING_SIZE]; 
-    int32_t httpResponseSize;
+    sensorSample sample;
 
-    getTemperatureStr(temperatureStr);
+    memset(temperatureStr, 0, sizeof(temperatureStr));
 
-    httpResponseSize = clarityHttpBuildResponseTextPlain(httpResponse,
-                                                 sizeof(httpResponse),
-                                                 200, "OK",
-                                                 temperatureStr);
+    sensorSampleGet(&sample);
+    getTemperatureStr(&sample, temperatureStr);
 
-    if ((clarityHttpServerSendInCb(conn, httpResponse, httpResponseSize)) 
-              != httpResponseSize)
-    {
-        PRINT("Send failed.", NULL);
-        return 1;
-    }
-
-    return 0;
+    return httpSendValue(conn, temperatureStr);
 }
 
 
@@ -209,47 +140,66 @@ uint32_t httpGetLux(const clarityHttpRequestInformation * info,
                            clarityConnectionInformation * conn)
 {
     (void)info;
-    (void)conn;
 
     char luxString[LUX_STRING_SIZE];
-    uint16_t httpResponseSize;
+    sensorSample sample;
 
-    getLuxStr(luxString);
-    
-    httpResponseSize = clarityHttpBuildResponseTextPlain(httpResponse,
-                                                         sizeof(httpResponse),
-                                                         200, "OK",
-                                                         luxString);
-
-    if (clarityHttpServerSendInCb(conn, httpResponse, httpResponseSize) != httpResponseSize)
-    {
-        PRINT("Send failed.", NULL);
-        return 1;
-    }
+    memset(luxString, 0, sizeof(luxString));
 
-    return 0;
+    sensorSampleGet(&sample);
+    getLuxStr(&sample, luxString);
+    
+    return httpSendValue(conn, luxString);
 }
 
 
-clarityError httpPostPressure(clarityTransportInformation * tcp,
-                              clarityHttpPersistant * persistant)
+/* Carries every reading in one request, one "resource value units" line
+ * each. The server fans these out to the individual resource logs. */
+clarityError httpPostBatch(clarityTransportInformation * tcp,
+                           clarityHttpPersistant * persistant)
 {
     clarityError rtn;
-    char buf[128];
+    char buf[192];
     clarityHttpResponseInformation response;
     int16_t postLen = 0;
+    char luxString[LUX_STRING_SIZE];
+    char temperatureStr[TEMPERATURE_STRING_SIZE];
     char pressureStr[PRESSURE_STRING_SIZE];
+    char body[BATCH_BODY_SIZE];
+    sensorSample sample;
 
     memset(buf, 0, sizeof(buf));
     memset(&response, 0, sizeof(response));
-    memset(&pressureStr,0,sizeof(pressureStr));
+    memset(body, 0, sizeof(body));
 
-    getPressureStr(pressureStr);
+    sensorSampleGet(&sample);
 
-    postLen = clarityHttpBuildPost(buf, sizeof(buf), "/cc3000", "/pressure", 
-                                   pressureStr, persistant);
+    if (getLuxStr(&sample, luxString) == 0)
+    {
+        strcat(body, "lux ");
+        strcat(body, luxString);
+        strcat(body, "\n");
+    }
+
+    if (getTemperatureStr(&sample, temperatureStr) == 0)
+    {
+        strcat(body, "temperature ");
+        strcat(body, temperatureStr);
+        strcat(body, "\n");
+    }
 
-    rtn = clarityHttpSendRequest(tcp, persistant, buf, sizeof(buf), postLen, &response);
+    if (getPressureStr(&sample, pressureStr) == 0)
+    {
+        strcat(body, "pressure ");
+        strcat(body, pressureStr);
+        strcat(body, "\n");
+    }
+
+    postLen = clarityHttpBuildPost(buf, sizeof(buf), "/cc3000", "/batch",
+                                   body, persistant);
+
+    rtn = clarityHttpSendRequest(tcp, persistant, buf, sizeof(buf),
+                                 postLen, &response);
 
     if (response.code == 200)
     {
@@ -258,63 +208,110 @@ clarityError httpPostPressure(clarityTransportInformation * tcp,
     else
     {
         PRINT("Response was NOT OK: %d.", response.code);
+
+        if (rtn == CLARITY_SUCCESS)
+        {
+            rtn = CLARITY_ERROR_REMOTE_REQUEST;
+        }
     }
     return rtn;
-
 }
 
-
-clarityError httpPostTemperature(clarityTransportInformation * tcp,
-                                 clarityHttpPersistant * persistant)
+static uint16_t encodeRecord(uint8_t * buf, sensorId id, unitCode unit,
+                             int32_t value, uint32_t sampleTime)
 {
-    clarityError rtn;
-    char buf[128];
-    clarityHttpResponseInformation response;
-    int16_t postLen = 0;
-    char temperatureStr[TEMPERATURE_STRING_SIZE];
-
-    memset(buf, 0, sizeof(buf));
-    memset(&response, 0, sizeof(response));
-    memset(temperatureStr, 0, sizeof(temperatureStr));
-
-    getTemperatureStr(temperatureStr);
-
-    postLen = clarityHttpBuildPost(buf, sizeof(buf), "/cc3000", "/temperature", 
-                                   temperatureStr, persistant);
+    buf[0] = id;
+    buf[1] = unit;
+    buf[2] = value;
+    buf[3] = value >> 8;
+    buf[4] = value >> 16;
+    buf[5] = value >> 24;
+    buf[6] = sampleTime;
+    buf[7] = sampleTime >> 8;
+    buf[8] = sampleTime >> 16;
+    buf[9] = sampleTime >> 24;
+
+    return MEASUREMENT_RECORD_SIZE;
+}
 
-    rtn = clarityHttpSendRequest(tcp, persistant, buf, sizeof(buf), postLen, &response);
+/* Encodes every valid reading of the sample. Returns bytes written. */
+uint16_t measurementEncodeSample(uint8_t * buf, const sensorSample * sample)
+{
+    uint32_t sampleTime = rtcTimeDateToSeconds(&sample->timestamp);
+    uint16_t len = 0;
 
-    if (response.code == 200)
+    if (sample->luxValid == true)
     {
-        PRINT("Response was OK: %d", response.code);
+        len += encodeRecord(buf + len, SENSOR_ID_LUX, UNIT_CODE_LUX,
+                            sample->lux, sampleTime);
     }
-    else
+
+    if (sample->barometerValid == true)
     {
-        PRINT("Response was NOT OK: %d.", response.code);
+        len += encodeRecord(buf + len, SENSOR_ID_TEMPERATURE,
+                            UNIT_CODE_KELVIN_X100, sample->temperature,
+                            sampleTime);
+
+        len += encodeRecord(buf + len, SENSOR_ID_PRESSURE,
+                            UNIT_CODE_KPA_X100, sample->pressure,
+                            sampleTime);
     }
-    return rtn;
 
+    return len;
 }
 
-clarityError httpPostLux(clarityTransportInformation * tcp,
-                         clarityHttpPersistant * persistant)
+/* Builds and sends a POST of binary records to the batch resource. The
+ * request is built here as clarityHttpBuildPost() only handles string bodies
+ * and has no way to set the Content-Type. */
+static clarityError postBinary(clarityTransportInformation * tcp,
+                               clarityHttpPersistant * persistant,
+                               char * buf, uint16_t bufSize,
+                               const uint8_t * body, uint16_t bodyLen)
 {
     clarityError rtn;
-    char buf[128];
     clarityHttpResponseInformation response;
     int16_t postLen = 0;
-    char luxString[LUX_STRING_SIZE];
+    char host[CLARITY_MAX_URL_LENGTH];
 
-    memset(buf, 0, sizeof(buf));
+    memset(buf, 0, bufSize);
     memset(&response, 0, sizeof(response));
-    memset(luxString,0,sizeof(luxString));
+    memset(host, 0, sizeof(host));
 
-    getLuxStr(luxString);
+    if (tcp->addr.type == CLARITY_ADDRESS_URL)
+    {
+        formatText(host, sizeof(host), "%s", tcp->addr.addr.url);
+    }
+    else
+    {
+        formatText(host, sizeof(host), "%u.%u.%u.%u",
+                 (unsigned)(tcp->addr.addr.ip >> 24) & 0xFF,
+                 (unsigned)(tcp->addr.addr.ip >> 16) & 0xFF,
+                 (unsigned)(tcp->addr.addr.ip >> 8) & 0xFF,
+                 (unsigned)tcp->addr.addr.ip & 0xFF);
+    }
+
+    postLen = formatText(buf, bufSize,
+                         "POST /cc3000/batch HTTP/1.1\r\n"
+                         "Host: %s\r\n"
+                         "Content-Type: " MEASUREMENT_CONTENT_TYPE "\r\n"
+                         "Content-Length: %u\r\n"
+                         "%s"
+                         "\r\n",
+                         host,
+                         (unsigned)bodyLen,
+                         persistant->closeOnComplete == true ?
+                              "Connection: close\r\n" : "");
+
+    if (postLen < 0 || postLen + bodyLen > bufSize)
+    {
+        PRINT_ERROR();
+        return CLARITY_ERROR_BUFFER_SIZE;
+    }
 
-    postLen = clarityHttpBuildPost(buf, sizeof(buf), "/cc3000", "/lux",
-                                   luxString, persistant);
+    memcpy(buf + postLen, body, bodyLen);
+    postLen += bodyLen;
 
-    rtn = clarityHttpSendRequest(tcp, persistant, buf, sizeof(buf),
+    rtn = clarityHttpSendRequest(tcp, persistant, buf, bufSize,
                                  postLen, &response);
 
     if (response.code == 200)
@@ -324,7 +321,99 @@ clarityError httpPostLux(clarityTransportInformation * tcp,
     else
     {
         PRINT("Response was NOT OK: %d.", response.code);
+
+        if (rtn == CLARITY_SUCCESS)
+        {
+            rtn = CLARITY_ERROR_REMOTE_REQUEST;
+        }
     }
     return rtn;
 }
 
+/* As httpPostBatch() but carries fixed point binary records. */
+clarityError httpPostBatchBinary(clarityTransportInformation * tcp,
+                                 clarityHttpPersistant * persistant)
+{
+    char buf[192];
+    uint8_t body[MEASUREMENT_RECORD_SIZE * 3];
+    uint16_t bodyLen;
+    sensorSample sample;
+
+    sensorSampleGet(&sample);
+
+    bodyLen = measurementEncodeSample(body, &sample);
+
+    return postBinary(tcp, persistant, buf, sizeof(buf), body, bodyLen);
+}
+
+/* Uploads the backlog of the EEPROM sample log as binary records, several
+ * samples per request. Samples are only discarded once the server has
+ * acknowledged them. The connection is closed after the last request. */
+clarityError httpPostSampleLog(clarityTransportInformation * tcp,
+                               clarityHttpPersistant * persistant)
+{
+    static char buf[SAMPLE_LOG_POST_SIZE];
+    static uint8_t body[SAMPLE_LOG_SAMPLES_PER_POST * MEASUREMENT_RECORD_SIZE * 3];
+    clarityError rtn = CLARITY_SUCCESS;
+    eepromError err;
+    uint16_t bodyLen;
+    uint32_t samples;
+    uint32_t encoded;
+    uint32_t remaining;
+    sensorSample sample;
+
+    while ((remaining = eepromSampleLogCount()) > 0)
+    {
+        bodyLen = 0;
+        encoded = 0;
+
+        for (samples = 0; 
+             samples < SAMPLE_LOG_SAMPLES_PER_POST && samples < remaining;
+             samples++)
+        {
+            err = eepromSampleLogRead(samples, &sample);
+
+            /* Torn by a power loss, it is discarded with the others */
+            if (err == EEPROM_ERROR_CORRUPT)
+            {
+                PRINT("Dropping corrupt logged sample %u.", samples);
+                continue;
+            }
+
+            if (err != EEPROM_ERROR_OK)
+            {
+                PRINT_ERROR();
+                break;
+            }
+
+            bodyLen += measurementEncodeSample(body + bodyLen, &sample);
+            encoded++;
+        }
+
+        if (samples == 0)
+        {
+            rtn = CLARITY_ERROR_UNDEFINED;
+            break;
+        }
+
+        if (encoded == 0)
+        {
+            eepromSampleLogDiscard(samples);
+            continue;
+        }
+
+        persistant->closeOnComplete = samples == remaining;
+
+        PRINT("Posting %u of %u logged samples.", encoded, remaining);
+
+        if ((rtn = postBinary(tcp, persistant, buf, sizeof(buf),
+                              body, bodyLen)) != CLARITY_SUCCESS)
+        {
+            break;
+        }
+
+        eepromSampleLogDiscard(samples);
+    }
+
+    return rtn;
+}
@@ -0,0 +1,317 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Deferred logging. PRINT() doesn't format anything: it copies a message id
+ * and its integer arguments into a ring buffer and returns, and a low
+ * priority thread later writes the records to the serial port as they are.
+ * The format strings never reach the image, utils/log_decode.py turns the
+ * records back into text using a table built from the sources, see the
+ * Makefile.
+ *
+ * Producers reserve space by advancing logHead with a compare and swap, so
+ * any thread or ISR may log without blocking or taking a lock. The id is
+ * written last and marks the record complete. The drain thread zeroes each
+ * record it has sent before releasing the space by advancing logTail. A
+ * record that doesn't fit is dropped and counted.
+ *
+ * Ring record, in words:
+ *   id             LOG_ID() of the call, 0 until the record is complete
+ *   argc << 24 | time   argument words and chTimeNow() at the call
+ *   args...        integers, or a string packed 4 bytes a word, NUL ended
+ * On the wire each record is preceded by LOG_SYNC_0 and LOG_SYNC_1, little
+ * endian as in memory. */
+
+#include <string.h>
+#include "fyp.h"
+#include "memstreams.h"
+
+#define LOG_RING_WORDS          256         /* Must be a power of 2 */
+#define LOG_RING_MASK           (LOG_RING_WORDS - 1)
+#define LOG_HEADER_WORDS        2
+#define LOG_STRING_WORDS        ((LOG_STRING_MAX + 3) / 4)
+#define LOG_RECORD_MAX_WORDS    (LOG_HEADER_WORDS + LOG_STRING_WORDS)
+#define LOG_TIME_MASK           0xFFFFFF
+
+#define LOG_SYNC_0              0xA5
+#define LOG_SYNC_1              0x5A
+
+#define LOG_THREAD_STACK        256
+#define LOG_DRAIN_PERIOD        MS2ST(20)
+
+static uint32_t logRing[LOG_RING_WORDS];
+static uint32_t logHead;
+static uint32_t logTail;
+static uint32_t logDropped;
+
+static WORKING_AREA(logThreadWa, LOG_THREAD_STACK);
+static Thread * logThreadTp;
+static BinarySemaphore logStopSem;
+
+/* Only used by the drain thread */
+static uint8_t logFrame[2 + LOG_RECORD_MAX_WORDS * sizeof(uint32_t)];
+
+/* debugPrint() formats into this, for the libraries which log text */
+static Mutex printMtx;
+static char printText[LOG_STRING_MAX];
+
+/* Sets start to the index of the first word of a record of words. Returns
+ * false if there isn't room. */
+static bool logReserve(uint32_t words, uint32_t * start)
+{
+    uint32_t head = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (head + words - __atomic_load_n(&logTail, __ATOMIC_ACQUIRE) > 
+                LOG_RING_WORDS)
+        {
+            __atomic_fetch_add(&logDropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (__atomic_compare_exchange_n(&logHead, &head, head + words, true,
+                                         __ATOMIC_RELAXED, 
+                                         __ATOMIC_RELAXED) == false);
+
+    *start = head;
+
+    return true;
+}
+
+static void logPut(uint32_t index, uint32_t word)
+{
+    logRing[index & LOG_RING_MASK] = word;
+}
+
+static void logCommit(uint32_t start, uint32_t id)
+{
+    __atomic_store_n(&logRing[start & LOG_RING_MASK], id, __ATOMIC_RELEASE);
+}
+
+void logWrite(uint32_t id, const uint32_t * args, uint32_t argc)
+{
+    uint32_t start;
+    uint32_t i;
+
+    if (argc > LOG_STRING_WORDS ||
+        logReserve(LOG_HEADER_WORDS + argc, &start) == false)
+    {
+        return;
+    }
+
+    logPut(start + 1, argc << 24 | (chTimeNow() & LOG_TIME_MASK));
+
+    for (i = 0; i < argc; i++)
+    {
+        logPut(start + LOG_HEADER_WORDS + i, args[i]);
+    }
+
+    logCommit(start, id);
+}
+
+/* Strings longer than LOG_STRING_MAX - 1 are truncated */
+void logWriteString(uint32_t id, const char * str)
+{
+    uint32_t len = strnlen(str, LOG_STRING_MAX - 1);
+    uint32_t words = len / 4 + 1;
+    uint8_t bytes[4];
+    uint32_t word;
+    uint32_t start;
+    uint32_t i;
+
+    if (logReserve(LOG_HEADER_WORDS + words, &start) == false)
+    {
+        return;
+    }
+
+    logPut(start + 1, words << 24 | (chTimeNow() & LOG_TIME_MASK));
+
+    for (i = 0; i < words; i++)
+    {
+        memset(bytes, 0, sizeof(bytes));
+        memcpy(bytes, str + i * 4, 
+               len - i * 4 < sizeof(bytes) ? len - i * 4 : sizeof(bytes));
+        memcpy(&word, bytes, sizeof(word));
+        logPut(start + LOG_HEADER_WORDS + i, word);
+    }
+
+    logCommit(start, id);
+}
+
+/* As vsnprintf(), but with chvprintf() so newlib's printf and its soft-float
+ * conversions aren't linked. Returns the length written, or -1 if it didn't
+ * fit. buf is NUL terminated either way. */
+int32_t formatTextV(char * buf, uint32_t size, const char * fmt, va_list ap)
+{
+    MemoryStream stream;
+
+    if (size == 0)
+    {
+        return -1;
+    }
+
+    msObjectInit(&stream, (uint8_t *)buf, size, 0);
+    chvprintf((BaseSequentialStream *)&stream, fmt, ap);
+
+    if (stream.eos == size)
+    {
+        buf[size - 1] = '\0';
+        return -1;
+    }
+
+    buf[stream.eos] = '\0';
+
+    return stream.eos;
+}
+
+int32_t formatText(char * buf, uint32_t size, const char * fmt, ...)
+{
+    int32_t len;
+    va_list ap;
+
+    va_start(ap, fmt);
+    len = formatTextV(buf, size, fmt, ap);
+    va_end(ap);
+
+    return len;
+}
+
+/* For the clarity and CC3000 libraries, which hand over format strings. The
+ * text is formatted here and logged as a string, cut short if too long. */
+void debugPrint(const char * fmt, ...)
+{
+    va_list ap;
+
+    chMtxLock(&printMtx);
+
+    va_start(ap, fmt);
+    formatTextV(printText, sizeof(printText), fmt, ap);
+    va_end(ap);
+
+    logWriteString(LOG_ID_TEXT, printText);
+
+    chMtxUnlock();
+}
+
+static void logSend(const uint32_t * words, uint32_t count)
+{
+    logFrame[0] = LOG_SYNC_0;
+    logFrame[1] = LOG_SYNC_1;
+    memcpy(logFrame + 2, words, count * sizeof(uint32_t));
+
+    chSequentialStreamWrite((BaseSequentialStream *)&SERIAL_DRIVER, logFrame,
+                            2 + count * sizeof(uint32_t));
+}
+
+/* Sends every complete record, stopping at the first one still being
+ * written. */
+static void logDrain(void)
+{
+    uint32_t record[LOG_RECORD_MAX_WORDS];
+    uint32_t tail = logTail;
+    uint32_t head = __atomic_load_n(&logHead, __ATOMIC_ACQUIRE);
+    uint32_t dropped;
+    uint32_t words;
+    uint32_t i;
+
+    while (tail != head)
+    {
+        if ((record[0] = __atomic_load_n(&logRing[tail & LOG_RING_MASK],
+                                         __ATOMIC_ACQUIRE)) == 0)
+        {
+            break;
+        }
+
+        record[1] = logRing[(tail + 1) & LOG_RING_MASK];
+        words = LOG_HEADER_WORDS + (record[1] >> 24);
+
+        for (i = 2; i < words; i++)
+        {
+            record[i] = logRing[(tail + i) & LOG_RING_MASK];
+        }
+
+        for (i = 0; i < words; i++)
+        {
+            logRing[(tail + i) & LOG_RING_MASK] = 0;
+        }
+
+        tail += words;
+        __atomic_store_n(&logTail, tail, __ATOMIC_RELEASE);
+
+        logSend(record, words);
+    }
+
+    if ((dropped = __atomic_exchange_n(&logDropped, 0, __ATOMIC_RELAXED)) != 0)
+    {
+        record[0] = LOG_ID_DROPPED;
+        record[1] = 1 << 24 | (chTimeNow() & LOG_TIME_MASK);
+        record[2] = dropped;
+        logSend(record, 3);
+    }
+}
+
+static msg_t logThread(void * arg)
+{
+    (void)arg;
+
+    chRegSetThreadName("log");
+
+    do
+    {
+        logDrain();
+    } while (chBSemWaitTimeout(&logStopSem, LOG_DRAIN_PERIOD) == RDY_TIMEOUT);
+
+    logDrain();
+
+    return 0;
+}
+
+/* The serial driver must be started first */
+void logStart(void)
+{
+    if (logThreadTp != NULL)
+    {
+        return;
+    }
+
+    chMtxInit(&printMtx);
+    chBSemInit(&logStopSem, TRUE);
+    logThreadTp = chThdCreateStatic(logThreadWa, sizeof(logThreadWa),
+                                    LOWPRIO, logThread, NULL);
+}
+
+/* Sends whatever is left and stops the drain thread. Anything logged after
+ * this stays in the ring. */
+void logStop(void)
+{
+    if (logThreadTp == NULL)
+    {
+        return;
+    }
+
+    chBSemSignal(&logStopSem);
+    chThdWait(logThreadTp);
+    logThreadTp = NULL;
+}
@@ -34,6 +34,8 @@
 #include "cc3000_chibios_api.h"
 #include "clarity_api.h"
 
+#define LOG_FILE                LOG_FILE_MAIN
+
 /* Key configuration information */
 #define SSID           "FYP"
 #define SSID_LEN        strlen(SSID)
@@ -43,10 +45,63 @@
 #define SERVER_PORT     9000
 #define STANDBY_TIME_S  60
 
+/* SNTP is only used once the RTC may be out by more than this, allowing for
+ * its measured drift. */
+#define CLOCK_MAX_ERROR_S 5
+
+/* TRUE to print the wake cycle phase timing before entering standby. */
 #define DEBUG_TIME_MEASURING  FALSE
 
-Mutex printMtx;
-static Mutex cc3000ApiMutex;
+/* Phase timing is posted as a batch to /cc3000_timing every
+ * TIMING_UPLOAD_EVERY_N radio wakes, the statistics restarting once it has
+ * been accepted. */
+#define TIMING_UPLOAD_EVERY_N 20
+
+/* TRUE to upload fixed point binary records rather than text. */
+#define UPLOAD_FORMAT_BINARY  FALSE
+
+/* TRUE to send each sample as one UDP datagram to UDP_SERVER_PORT rather than
+ * as an HTTP POST. With UDP_ACK TRUE it is resent until the server acks. */
+#define UPLOAD_TRANSPORT_UDP  FALSE
+#define UDP_SERVER_PORT       9001
+#define UDP_ACK               TRUE
+
+/* TRUE to log a sample to EEPROM on every wake and only bring up the CC3000
+ * every UPLOAD_EVERY_N_WAKES wakes, or once the log is nearly full. The
+ * backlog is uploaded as binary records. The host build's check sets it from
+ * the command line. */
+#if !defined(STORE_AND_FORWARD)
+#define STORE_AND_FORWARD     FALSE
+#endif
+#define UPLOAD_EVERY_N_WAKES  10
+#define SAMPLE_LOG_HEADROOM   16    /* Samples of space left that trigger an upload */
+
+/* TRUE to only bring up the CC3000 when a reading has changed beyond its
+ * deadband or has been silent too long. The standby interval then adapts
+ * instead of being STANDBY_TIME_S. See policy.c. */
+#define REPORT_ON_CHANGE      FALSE
+
+#if REPORT_ON_CHANGE == TRUE && STORE_AND_FORWARD == TRUE
+#error "REPORT_ON_CHANGE and STORE_AND_FORWARD can't be combined."
+#endif
+
+/* TRUE to drive STORE_AND_FORWARD from the RTC wakeup timer. A sample is
+ * logged every SCHEDULE_SAMPLE_S and the log uploaded every
+ * SCHEDULE_UPLOAD_S, replacing STANDBY_TIME_S and UPLOAD_EVERY_N_WAKES. */
+#if !defined(USE_WAKEUP_SCHEDULER)
+#define USE_WAKEUP_SCHEDULER  FALSE
+#endif
+#define SCHEDULE_SAMPLE_S     15
+#define SCHEDULE_UPLOAD_S     600
+
+#if USE_WAKEUP_SCHEDULER == TRUE && STORE_AND_FORWARD != TRUE
+#error "USE_WAKEUP_SCHEDULER requires STORE_AND_FORWARD."
+#endif
+
+/* How long the POST waits for the sensor service's first sample. */
+#define SENSOR_SAMPLE_TIMEOUT MS2ST(2000)
+
+Mutex cc3000ApiMutex;
 static clarityHttpServerInformation controlInfo;
 
 
@@ -62,34 +117,36 @@ static clarityAccessPointInformation ap =   {SSID,
                                              },
                                             };
 
+#if USE_WAKEUP_SCHEDULER == TRUE
+static const uint32_t schedulePeriods[SCHEDULES] = {
+    [SCHEDULE_SAMPLE] = SCHEDULE_SAMPLE_S,
+    [SCHEDULE_UPLOAD] = SCHEDULE_UPLOAD_S
+};
+#endif
+
 static SPIConfig cc3000SpiConfig;
 static EXTConfig cc3000ExtConfig;
 
 uint8_t zero = 0x00;
 
-void debugPrint(const char * fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    chMtxLock(&printMtx);
-    chvprintf((BaseSequentialStream*)&SERIAL_DRIVER, fmt, ap);
-    chMtxUnlock();
-    va_end(ap);
-}
-
 static uint32_t httpGetRoot(const clarityHttpRequestInformation * info, 
                             clarityConnectionInformation * conn)
 {
     static const char * rootStr = "You are seeing this as a result of a GET "
                                   "request on the root resource of this server.";
-    uint32_t txBytes;
+    char response[192];
+    int16_t responseSize;
 
     (void)info;
 
-    if ((txBytes = clarityHttpServerSendInCb(conn, rootStr, strlen(rootStr))) != 
-         strlen(rootStr))
+    responseSize = clarityHttpBuildResponseTextPlain(response, sizeof(response),
+                                                     200, "OK", rootStr);
+
+    if (responseSize < 0 ||
+        clarityHttpServerSendInCb(conn, response, responseSize) != 
+            (uint32_t)responseSize)
     {
-        PRINT("Send failed.", NULL);
+        PRINT("Send failed.");
         while(1);
         return 1;
     }
@@ -117,6 +174,10 @@ static void initialiseControl(clarityHttpServerInformation * controlInfo)
     controlInfo->resources[3].methods[0].type = GET;
     controlInfo->resources[3].methods[0].callback = httpGetLux;
 
+    controlInfo->resources[4].name = "/stats";
+    controlInfo->resources[4].methods[0].type = GET;
+    controlInfo->resources[4].methods[0].callback = httpGetStats;
+
 }
 
 static void initialiseCC3000(void)
@@ -192,8 +253,9 @@ static void initialiseCC3000(void)
 
     chMtxInit(&cc3000ApiMutex);
 
+    /* The SPI driver was initialised by halInit(). It mustn't be
+     * reinitialised here as the sensor thread may already hold the bus. */
     extObjectInit(&CC3000_EXT_DRIVER);
-    spiObjectInit(&CC3000_SPI_DRIVER);
     
     chThdSleep(MS2ST(500));
     cc3000ChibiosWlanInit(&CC3000_SPI_DRIVER, &cc3000SpiConfig,
@@ -225,9 +287,23 @@ static void deinitialiseCC3000(void)
                   PAL_MODE_UNCONNECTED);
 }
 
+/* Enters standby until the next wake, seconds from now unless the wakeup
+ * scheduler decides. */
+static void sleepUntilNextWake(uint32_t seconds)
+{
+    logStop();
+
+#if USE_WAKEUP_SCHEDULER == TRUE
+    (void)seconds;
+    schedulerStandby();
+#else
+    configureRtcAlarmAndStandby(&RTC_DRIVER, seconds);
+#endif
+}
+
 static void cc3000Unresponsive(void)
 {
-    PRINT("Clarity thinks CC3000 was unresponsive...", NULL);
+    PRINT("Clarity thinks CC3000 was unresponsive...");
 
     /* TODO debugging XXX */
 #if 1
@@ -239,7 +315,7 @@ static void cc3000Unresponsive(void)
 #endif
 
     eepromRecordUnresponsiveShutdown();
-    configureRtcAlarmAndStandby(&RTC_DRIVER, STANDBY_TIME_S);
+    sleepUntilNextWake(STANDBY_TIME_S);
 
 }
 
@@ -278,6 +354,70 @@ void deinitialiseHw(void)
 }
 
 
+#if STORE_AND_FORWARD == TRUE
+static void storeSample(void)
+{
+    sensorSample sample;
+
+    if (sensorSampleUpdate() != 0)
+    {
+        PRINT_ERROR();
+    }
+
+    sensorSampleGet(&sample);
+
+    if (eepromSampleLogAppend(&sample) != EEPROM_ERROR_OK)
+    {
+        PRINT_ERROR();
+    }
+}
+
+static bool sampleLogNearlyFull(void)
+{
+    return eepromSampleLogCount() + SAMPLE_LOG_HEADROOM >= 
+           eepromSampleLogCapacity();
+}
+
+#if USE_WAKEUP_SCHEDULER == TRUE
+/* Logs a sample if that schedule fired, setting sampled if so. Returns true
+ * if the radio should be brought up to upload the log. */
+static bool storeSampleUploadDue(bool * sampled)
+{
+    uint32_t fired = schedulerWake(schedulePeriods);
+
+    *sampled = SCHEDULE_FIRED(fired, SCHEDULE_SAMPLE);
+
+    if (*sampled)
+    {
+        storeSample();
+    }
+
+    return SCHEDULE_FIRED(fired, SCHEDULE_UPLOAD) || sampleLogNearlyFull();
+}
+#else
+/* Logs this wake's sample, setting sampled. Returns true if the radio should
+ * be brought up to upload the log. */
+static bool storeSampleUploadDue(bool * sampled)
+{
+    uint32_t wakes;
+
+    *sampled = true;
+    storeSample();
+
+    wakes = rtcBackupRead(BACKUP_REG_WAKE_COUNT) + 1;
+
+    if (wakes >= UPLOAD_EVERY_N_WAKES || sampleLogNearlyFull())
+    {
+        rtcBackupWrite(BACKUP_REG_WAKE_COUNT, 0);
+        return true;
+    }
+
+    rtcBackupWrite(BACKUP_REG_WAKE_COUNT, wakes);
+    return false;
+}
+#endif /* USE_WAKEUP_SCHEDULER */
+#endif /* STORE_AND_FORWARD */
+
 clarityError httpPostShutdownError(clarityTransportInformation * tcp,
                                    clarityHttpPersistant * persistant)
 {
@@ -309,28 +449,141 @@ clarityError httpPostShutdownError(clarityTransportInformation * tcp,
     return rtn;
 }
 
+/* Uploads this wake's samples with whichever transport is configured. */
+static clarityError postSamples(clarityTransportInformation * tcp,
+                                clarityHttpPersistant * persistant)
+{
+#if STORE_AND_FORWARD == TRUE
+    return httpPostSampleLog(tcp, persistant);
+#elif UPLOAD_TRANSPORT_UDP == TRUE
+    clarityTransportInformation udp = *tcp;
+    (void)persistant;
+    udp.port = UDP_SERVER_PORT;
+    return udpPostSample(&udp, UDP_ACK);
+#elif UPLOAD_FORMAT_BINARY == TRUE
+    return httpPostBatchBinary(tcp, persistant);
+#else
+    return httpPostBatch(tcp, persistant);
+#endif
+}
+
+/* Returns true once every TIMING_UPLOAD_EVERY_N calls. */
+static bool timingUploadDue(void)
+{
+    uint32_t wakes = rtcBackupRead(BACKUP_REG_TIMING_UPLOAD) + 1;
+
+    if (wakes >= TIMING_UPLOAD_EVERY_N)
+    {
+        rtcBackupWrite(BACKUP_REG_TIMING_UPLOAD, 0);
+        return true;
+    }
+
+    rtcBackupWrite(BACKUP_REG_TIMING_UPLOAD, wakes);
+    return false;
+}
+
+clarityError httpPostTiming(clarityTransportInformation * tcp,
+                            clarityHttpPersistant * persistant)
+{
+    clarityError rtn;
+    static char body[TIMING_FORMAT_MAX];
+    static char buf[TIMING_FORMAT_MAX + 150];
+    clarityHttpResponseInformation response;
+    int16_t postLen = 0;
+
+    memset(buf, 0, sizeof(buf));
+    memset(&response, 0, sizeof(response));
+
+    if (timingFormat(body, sizeof(body)) < 0)
+    {
+        PRINT_ERROR();
+        return CLARITY_ERROR_BUFFER_SIZE;
+    }
+
+    postLen = clarityHttpBuildPost(buf, sizeof(buf), "/cc3000_timing", "/batch",
+                                   body, persistant);
+
+    if ((rtn = clarityHttpSendRequest(tcp, persistant, buf, sizeof(buf),
+                                     postLen, &response)) != CLARITY_SUCCESS)
+    {
+        PRINT_ERROR();
+    }
+
+    if (response.code == 200)
+    {
+        PRINT("Response was OK: %d", response.code);
+
+        if (rtn == CLARITY_SUCCESS)
+        {
+            timingReset();
+        }
+    }
+    else
+    {
+        PRINT("Response was NOT OK: %d.", response.code);
+    }
+    return rtn;
+}
+
 int main(void)
 {
+    bool sampled = false;
+#if REPORT_ON_CHANGE == TRUE
+    sensorSample sample;
+#endif
+
+    timingInit();
+
+    timingPhaseStart(TIMING_PHASE_HAL_INIT);
     halInit();
+    timingPhaseEnd(TIMING_PHASE_HAL_INIT);
     
     chSysInit();
 
-    chMtxInit(&printMtx);
+    rtcClockLoad();
 
-#if DEBUG_TIME_MEASURING == TRUE
-    rtcRetrieve(&RTC_DRIVER, &timingData);
-    PRINT("Started. Minute: %d Seconds: %d", timingData.time.minute,  
-                                             timingData.time.seconds);
+    initialiseDebugHw();
+
+    logStart();
+
+    initialiseSensorHw();
+
+#if STORE_AND_FORWARD == TRUE
+    if (storeSampleUploadDue(&sampled) == false)
+    {
+        PRINT("Sample logged, upload not due.");
+        deinitialiseSensorHw();
+        sleepUntilNextWake(STANDBY_TIME_S);
+    }
+#elif REPORT_ON_CHANGE == TRUE
+    /* The policy needs this wake's sample before the radio is brought up. */
+    if (sensorSampleUpdate() != 0)
+    {
+        PRINT_ERROR();
+    }
+
+    sampled = true;
+    sensorSampleGet(&sample);
+
+    if (policyReportDue(&sample) == false && 
+        eepromWasLastShutdownOk() == EEPROM_ERROR_OK)
+    {
+        PRINT("No change to report.");
+        deinitialiseSensorHw();
+        sleepUntilNextWake(policyStandbySeconds());
+    }
 #endif
 
-    initialiseDebugHw();
+    /* Conversions run while the CC3000 powers up and associates, after which
+     * the service keeps sampling for the HTTP server. */
+    sensorServiceStart(sampled);
 
+    timingPhaseStart(TIMING_PHASE_CC3000_INIT);
     initialiseCC3000();
+    timingPhaseEnd(TIMING_PHASE_CC3000_INIT);
 
     initialiseControl(&controlInfo);
 
-    initialiseSensorHw();
-
     clarityTransportInformation tcp;
 
     memset(&tcp, 0, sizeof(tcp));
@@ -339,39 +592,50 @@ int main(void)
     strncpy(tcp.addr.addr.url, SERVER_URL, CLARITY_MAX_URL_LENGTH);
     tcp.port = SERVER_PORT;
 
-    PRINT("Starting...", NULL);
+    PRINT("Starting...");
 
+    timingPhaseStart(TIMING_PHASE_ASSOCIATE);
     if (clarityInit(&cc3000ApiMutex, cc3000Unresponsive, &ap, debugPrint) != CLARITY_SUCCESS) 
     { 
         PRINT_ERROR();
     }
+    timingPhaseEnd(TIMING_PHASE_ASSOCIATE);
+
     clarityHttpPersistant persistant;
     memset(&persistant,0,sizeof(persistant));
     persistant.closeOnComplete = false;
 
-    clarityTimeDate time;
-    rtcRetrieve(&RTC_DRIVER, &time);
+    clarityError rtn;
     
     clarityRegisterProcessStarted();
 
-    if (time.date.year < 14)
+    if (rtcSyncDue(CLOCK_MAX_ERROR_S) == true)
     {
-        PRINT("Time needs updated.", NULL);
+        PRINT("Time needs updated.");
+        timingPhaseStart(TIMING_PHASE_SNTP);
         if (updateRtcWithSntp() != 0)
         {
             PRINT_ERROR();
         }
+        timingPhaseEnd(TIMING_PHASE_SNTP);
     }
     else
     {
-        PRINT("Time doesn't need updated.", NULL);
+        PRINT("Time doesn't need updated.");
     }
 
+    /* After SNTP, as the cache expiry relies on the RTC. */
+    addressCacheLookup(SERVER_URL, &tcp.addr);
+
     if (eepromWasLastShutdownOk() != EEPROM_ERROR_OK)
     {
-        PRINT("Last shutdown was not OK.", NULL);
+        PRINT("Last shutdown was not OK.");
+
+        timingPhaseStart(TIMING_PHASE_POST_ERROR);
+        rtn = httpPostShutdownError(&tcp, &persistant);
+        timingPhaseEnd(TIMING_PHASE_POST_ERROR);
 
-        if (httpPostShutdownError(&tcp, &persistant) == 0)
+        if (rtn == CLARITY_SUCCESS)
         {
             if (eepromAcknowledgeLastShutdownError() != EEPROM_ERROR_OK)
             {
@@ -385,28 +649,60 @@ int main(void)
     }
     else
     {
-        PRINT("Last shutdown was OK.", NULL);
+        PRINT("Last shutdown was OK.");
     }
 
-    PRINT("Posting Lux.", NULL);
-    if (httpPostLux(&tcp, &persistant) != CLARITY_SUCCESS)
+    /* Sent ahead of the samples, which close the connection. */
+    if (timingUploadDue() == true)
     {
-        PRINT_ERROR();
+        PRINT("Posting timing.");
+        timingPhaseStart(TIMING_PHASE_POST_TIMING);
+        if (httpPostTiming(&tcp, &persistant) != CLARITY_SUCCESS)
+        {
+            PRINT_ERROR();
+        }
+        timingPhaseEnd(TIMING_PHASE_POST_TIMING);
     }
- 
-    PRINT("Posting Temperature.", NULL);
-    if (httpPostTemperature(&tcp, &persistant) != CLARITY_SUCCESS)
+
+#if STORE_AND_FORWARD == TRUE
+    PRINT("Posting sample log.");
+#else
+    if (sensorSampleWait(SENSOR_SAMPLE_TIMEOUT) != 0)
     {
         PRINT_ERROR();
     }
 
+#if REPORT_ON_CHANGE == TRUE
+    /* Record what is actually posted */
+    sensorSampleGet(&sample);
+#endif
+
     persistant.closeOnComplete = true;
 
-    PRINT("Posting Pressure.", NULL);
-    if (httpPostPressure(&tcp, &persistant) != CLARITY_SUCCESS)
+    PRINT("Posting Batch.");
+#endif /* STORE_AND_FORWARD */
+
+    timingPhaseStart(TIMING_PHASE_POST_SAMPLES);
+    rtn = postSamples(&tcp, &persistant);
+
+    if (rtn != CLARITY_SUCCESS && 
+        addressCacheRefresh(SERVER_URL, &tcp.addr) == true)
+    {
+        PRINT("Retrying with a freshly resolved address.");
+        rtn = postSamples(&tcp, &persistant);
+    }
+
+    if (rtn != CLARITY_SUCCESS)
     {
         PRINT_ERROR();
     }
+#if REPORT_ON_CHANGE == TRUE
+    else
+    {
+        policyReported(&sample);
+    }
+#endif
+    timingPhaseEnd(TIMING_PHASE_POST_SAMPLES);
 
 #if 1
     if (clarityHttpServerStart(&controlInfo) != CLARITY_SUCCESS)
@@ -421,38 +717,51 @@ int main(void)
             break;
         }
 
-        PRINT("main sleeping", NULL);
+        PRINT("main sleeping");
         chThdSleep(MS2ST(100));
     }
 
-    PRINT("Shutting down...", NULL);
+    PRINT("Shutting down...");
 
     if (clarityHttpServerStop() != CLARITY_SUCCESS)
     {
-        PRINT("clarityHttpServerStop() failed", NULL);
+        PRINT("clarityHttpServerStop() failed");
     }
     
 #endif
 
+    sensorServiceStop();
+
     clarityRegisterProcessFinished();
-    PRINT("Done.", NULL);
+    PRINT("Done.");
  
+    timingPhaseStart(TIMING_PHASE_SHUTDOWN);
     if (clarityShutdown() != CLARITY_SUCCESS)
     {
-        PRINT("clarityShutdown() failed", NULL);
+        PRINT("clarityShutdown() failed");
     }
 
-    PRINT("Shut down.", NULL);
+    PRINT("Shut down.");
 
     deinitialiseCC3000();
+    timingPhaseEnd(TIMING_PHASE_SHUTDOWN);
 
 #if DEBUG_TIME_MEASURING == TRUE
-    rtcRetrieve(&RTC_DRIVER, &timingData);
-    PRINT("Started. Minute: %d Seconds: %d", timingData.time.minute,  
-                                             timingData.time.seconds);
+    {
+        static char timingStr[TIMING_FORMAT_MAX];
+
+        if (timingFormat(timingStr, sizeof(timingStr)) >= 0)
+        {
+            PRINT_STR("Timing: %s", timingStr);
+        }
+    }
 #endif
 
-    configureRtcAlarmAndStandby(&RTC_DRIVER, STANDBY_TIME_S);
+#if REPORT_ON_CHANGE == TRUE
+    sleepUntilNextWake(policyStandbySeconds());
+#else
+    sleepUntilNextWake(STANDBY_TIME_S);
+#endif
 
     return 0;
 }
@@ -0,0 +1,183 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Change driven reporting. Each wake's sample is compared against the values
+ * last reported; the radio is only brought up when a sensor has moved beyond
+ * its deadband, its validity changed, or nothing has been reported for
+ * POLICY_MAX_SILENCE_S. The standby interval drops back to the minimum on a
+ * change and doubles towards the maximum while readings are steady. State is
+ * kept in the EEPROM record log and only written when it changes. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "fyp.h"
+
+#define LOG_FILE                LOG_FILE_POLICY
+
+#define POLICY_DEADBAND_LUX         20      /* lx */
+#define POLICY_DEADBAND_TEMPERATURE 50      /* K * 100 */
+#define POLICY_DEADBAND_PRESSURE    10      /* kPa * 100 */
+
+#define POLICY_MIN_INTERVAL_S       60
+#define POLICY_MAX_INTERVAL_S       960
+#define POLICY_MAX_SILENCE_S        3600
+
+#define POLICY_FLAG_REPORTED        0x01    /* A report has been made */
+#define POLICY_FLAG_LUX_VALID       0x02
+#define POLICY_FLAG_BAROMETER_VALID 0x04
+
+typedef struct {
+    uint32_t lastReport;        /* Seconds since 2000-01-01 */
+    int32_t lux;
+    int32_t temperature;
+    int32_t pressure;
+    uint16_t interval;          /* Seconds */
+    uint16_t flags;
+} policyState;
+
+static policyState state;
+static bool stateLoaded = false;
+static bool stateDirty = false;
+
+static void policyLoad(void)
+{
+    if (stateLoaded == true)
+    {
+        return;
+    }
+
+    if (eepromRecordRead(EEPROM_RECORD_POLICY, &state, sizeof(state)) 
+            != EEPROM_ERROR_OK || state.interval < POLICY_MIN_INTERVAL_S)
+    {
+        memset(&state, 0, sizeof(state));
+        state.interval = POLICY_MIN_INTERVAL_S;
+    }
+
+    stateLoaded = true;
+}
+
+static bool outsideDeadband(int32_t last, int32_t now, int32_t deadband)
+{
+    return now - last > deadband || last - now > deadband;
+}
+
+static bool sampleChanged(const sensorSample * sample)
+{
+    if (sample->luxValid != ((state.flags & POLICY_FLAG_LUX_VALID) != 0) ||
+        sample->barometerValid != 
+            ((state.flags & POLICY_FLAG_BAROMETER_VALID) != 0))
+    {
+        return true;
+    }
+
+    if (sample->luxValid &&
+        outsideDeadband(state.lux, sample->lux, POLICY_DEADBAND_LUX))
+    {
+        return true;
+    }
+
+    if (sample->barometerValid &&
+        (outsideDeadband(state.temperature, sample->temperature,
+                         POLICY_DEADBAND_TEMPERATURE) ||
+         outsideDeadband(state.pressure, sample->pressure,
+                         POLICY_DEADBAND_PRESSURE)))
+    {
+        return true;
+    }
+
+    return false;
+}
+
+/* Returns true if sample should be reported this wake. Also adapts the
+ * interval returned by policyStandbySeconds(). */
+bool policyReportDue(const sensorSample * sample)
+{
+    uint32_t now = rtcTimeDateToSeconds(&sample->timestamp);
+    uint32_t interval;
+    bool changed;
+
+    policyLoad();
+
+    if ((changed = sampleChanged(sample)) == true)
+    {
+        interval = POLICY_MIN_INTERVAL_S;
+    }
+    else
+    {
+        interval = state.interval * 2;
+        interval = interval > POLICY_MAX_INTERVAL_S ? 
+                   POLICY_MAX_INTERVAL_S : interval;
+    }
+
+    if (interval != state.interval)
+    {
+        state.interval = interval;
+        stateDirty = true;
+    }
+
+    /* A clock that has gone backwards (e.g. set by SNTP) also forces one. */
+    return changed ||
+           (state.flags & POLICY_FLAG_REPORTED) == 0 ||
+           now < state.lastReport ||
+           now - state.lastReport >= POLICY_MAX_SILENCE_S;
+}
+
+/* Records sample as the last values successfully reported. */
+void policyReported(const sensorSample * sample)
+{
+    policyLoad();
+
+    state.lastReport = rtcTimeDateToSeconds(&sample->timestamp);
+    state.lux = sample->lux;
+    state.temperature = sample->temperature;
+    state.pressure = sample->pressure;
+    state.flags = POLICY_FLAG_REPORTED |
+                  (sample->luxValid ? POLICY_FLAG_LUX_VALID : 0) |
+                  (sample->barometerValid ? POLICY_FLAG_BAROMETER_VALID : 0);
+    stateDirty = true;
+}
+
+/* Returns the time to spend in standby before the next wake, persisting the
+ * policy state first if it changed. */
+uint32_t policyStandbySeconds(void)
+{
+    policyLoad();
+
+    if (stateDirty == true)
+    {
+        if (eepromRecordWrite(EEPROM_RECORD_POLICY, &state, sizeof(state))
+                != EEPROM_ERROR_OK)
+        {
+            PRINT_ERROR();
+        }
+
+        stateDirty = false;
+    }
+
+    return state.interval;
+}
+
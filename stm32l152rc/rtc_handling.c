@@ -31,7 +31,11 @@
 #include "fyp.h"
 #include "chprintf.h"
 
+#define LOG_FILE                LOG_FILE_RTC_HANDLING
+
 #define DAY_S           (60 * 60 * 24)
+#define HOUR_S          (60 * 60)
+#define MINUTE_S        60
 
 /* RTC Time and Date */
 #define DR_YT_SHIFT     20
@@ -97,6 +101,25 @@
 #define ALRMAR_ST_MASK          (0x3 << ALRMAR_ST_SHIFT)   
 #define ALRMAR_SU_MASK          (0xF << ALRMAR_SU_SHIFT)   
 
+/* Clock drift. The RTC is only ever set by SNTP, so between syncs its error
+ * grows linearly with the crystal's offset. That offset is measured at each
+ * sync and removed from every reading. Until it has been measured the
+ * uncorrected crystal tolerance is assumed. */
+#define CLOCK_VALID             0x01    /* syncTime is set */
+#define CLOCK_CALIBRATED        0x02    /* driftPpb has been measured */
+#define CLOCK_UNCALIBRATED_PPM  50
+#define CLOCK_CALIBRATED_PPM    10
+#define CLOCK_DRIFT_MAX_PPB     500000
+#define CLOCK_DRIFT_MIN_S       (12 * HOUR_S)   /* Shortest span to measure */
+
+typedef struct {
+    uint32_t syncTime;      /* Seconds since 2000 the RTC was last set to */
+    int32_t driftPpb;       /* Seconds gained per 10^9 RTC seconds */
+    uint32_t flags;
+} rtcClockState;
+
+static rtcClockState clockState;
+
 
 void rtcStore(RTCDriver * driver, const clarityTimeDate * info)
 {
@@ -150,7 +173,7 @@ void rtcStore(RTCDriver * driver, const clarityTimeDate * info)
 }
 
 
-void rtcRetrieve(RTCDriver * driver, clarityTimeDate * info)
+static void rtcRetrieveRaw(RTCDriver * driver, clarityTimeDate * info)
 {
     RTCTime chRtcTime;
     
@@ -184,6 +207,212 @@ void rtcRetrieve(RTCDriver * driver, clarityTimeDate * info)
 }
 
 
+static bool isLeapYear(uint32_t year)
+{
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/* Seconds elapsed since 2000-01-01 00:00:00, the epoch implied by the two
+ * digit year held in the RTC. */
+uint32_t rtcTimeDateToSeconds(const clarityTimeDate * info)
+{
+    static const uint16_t daysBeforeMonth[12] = {0, 31, 59, 90, 120, 151,
+                                                 181, 212, 243, 273, 304, 334};
+    uint32_t days = 0;
+    uint32_t year;
+
+    for (year = 0; year < info->date.year; year++)
+    {
+        days += isLeapYear(2000 + year) ? 366 : 365;
+    }
+
+    if (info->date.month >= 1 && info->date.month <= 12)
+    {
+        days += daysBeforeMonth[info->date.month - 1];
+    }
+
+    if (info->date.month > 2 && isLeapYear(2000 + info->date.year))
+    {
+        days++;
+    }
+
+    if (info->date.date > 0)
+    {
+        days += info->date.date - 1;
+    }
+
+    return days * DAY_S + 
+           info->time.hour * HOUR_S + 
+           info->time.minute * MINUTE_S + 
+           info->time.second;
+}
+
+/* Inverse of rtcTimeDateToSeconds() */
+void rtcSecondsToTimeDate(uint32_t seconds, clarityTimeDate * info)
+{
+    static const uint8_t daysInMonth[12] = {31, 28, 31, 30, 31, 30, 
+                                            31, 31, 30, 31, 30, 31};
+    uint32_t days = seconds / DAY_S;
+    uint32_t remainder = seconds % DAY_S;
+    uint32_t daysThisPeriod;
+    uint8_t year = 0;
+    uint8_t month = 0;
+
+    /* 2000-01-01 was a Saturday, the RTC counts Monday as 1 */
+    info->date.day = ((days + 5) % 7) + 1;
+
+    while (days >= (daysThisPeriod = isLeapYear(2000 + year) ? 366 : 365))
+    {
+        days -= daysThisPeriod;
+        year++;
+    }
+
+    while (1)
+    {
+        daysThisPeriod = daysInMonth[month];
+        
+        if (month == 1 && isLeapYear(2000 + year))
+        {
+            daysThisPeriod++;
+        }
+
+        if (days < daysThisPeriod)
+        {
+            break;
+        }
+
+        days -= daysThisPeriod;
+        month++;
+    }
+
+    info->date.year = year;
+    info->date.month = month + 1;
+    info->date.date = days + 1;
+
+    info->time.hour = remainder / HOUR_S;
+    remainder %= HOUR_S;
+    info->time.minute = remainder / MINUTE_S;
+    info->time.second = remainder % MINUTE_S;
+}
+
+/* Reads back the last SNTP sync and measured drift. Until called readings
+ * are uncorrected. */
+void rtcClockLoad(void)
+{
+    if (eepromRecordRead(EEPROM_RECORD_CLOCK, &clockState, sizeof(clockState))
+            != EEPROM_ERROR_OK)
+    {
+        memset(&clockState, 0, sizeof(clockState));
+    }
+}
+
+static uint32_t rtcCorrect(uint32_t raw)
+{
+    if ((clockState.flags & CLOCK_CALIBRATED) == 0 || raw < clockState.syncTime)
+    {
+        return raw;
+    }
+
+    return raw + (int32_t)(((int64_t)(raw - clockState.syncTime) * 
+                            clockState.driftPpb) / 1000000000);
+}
+
+/* Current time with the measured drift removed. */
+void rtcRetrieve(RTCDriver * driver, clarityTimeDate * info)
+{
+    clarityTimeDate raw;
+
+    rtcRetrieveRaw(driver, &raw);
+
+    if ((clockState.flags & CLOCK_CALIBRATED) == 0)
+    {
+        memcpy(info, &raw, sizeof(*info));
+        return;
+    }
+
+    rtcSecondsToTimeDate(rtcCorrect(rtcTimeDateToSeconds(&raw)), info);
+}
+
+/* True if the RTC has never been set, has gone backwards, or may now be out
+ * by more than maxErrorS. */
+bool rtcSyncDue(uint32_t maxErrorS)
+{
+    clarityTimeDate raw;
+    uint32_t now;
+    uint32_t ppm;
+
+    rtcRetrieveRaw(&RTC_DRIVER, &raw);
+    now = rtcTimeDateToSeconds(&raw);
+
+    if (raw.date.year < 14 || (clockState.flags & CLOCK_VALID) == 0 ||
+        now < clockState.syncTime)
+    {
+        return true;
+    }
+
+    ppm = clockState.flags & CLOCK_CALIBRATED ? CLOCK_CALIBRATED_PPM :
+                                                CLOCK_UNCALIBRATED_PPM;
+
+    return (uint64_t)(now - clockState.syncTime) * ppm >= 
+           (uint64_t)maxErrorS * 1000000;
+}
+
+/* Measures the drift since the last sync against sntpTime and saves the
+ * state for the sync about to be made. */
+static void rtcClockSynced(uint32_t sntpTime)
+{
+    clarityTimeDate raw;
+    uint32_t now;
+    uint32_t elapsed;
+    int64_t measured;
+
+    rtcRetrieveRaw(&RTC_DRIVER, &raw);
+    now = rtcTimeDateToSeconds(&raw);
+    elapsed = now - clockState.syncTime;
+
+    if ((clockState.flags & CLOCK_VALID) && now > clockState.syncTime &&
+        raw.date.year >= 14 && elapsed >= CLOCK_DRIFT_MIN_S)
+    {
+        measured = ((int64_t)sntpTime - now) * 1000000000 / elapsed;
+
+        if (measured > CLOCK_DRIFT_MAX_PPB || measured < -CLOCK_DRIFT_MAX_PPB)
+        {
+            PRINT("Ignoring implausible drift.");
+        }
+        else if (clockState.flags & CLOCK_CALIBRATED)
+        {
+            clockState.driftPpb = (clockState.driftPpb + measured) / 2;
+        }
+        else
+        {
+            clockState.driftPpb = measured;
+            clockState.flags |= CLOCK_CALIBRATED;
+        }
+    }
+
+    clockState.syncTime = sntpTime;
+    clockState.flags |= CLOCK_VALID;
+
+    if (eepromRecordWrite(EEPROM_RECORD_CLOCK, &clockState, sizeof(clockState))
+            != EEPROM_ERROR_OK)
+    {
+        PRINT_ERROR();
+    }
+}
+
+/* The backup registers keep their value through standby. They are only lost
+ * with the backup domain, in which case they read back as 0. */
+uint32_t rtcBackupRead(rtcBackupRegister reg)
+{
+    return (&RTC->BKP0R)[reg];
+}
+
+void rtcBackupWrite(rtcBackupRegister reg, uint32_t value)
+{
+    PWR->CR |= PWR_CR_DBP;
+    (&RTC->BKP0R)[reg] = value;
+}
+
 int32_t rtcConstructAlarm(RTCAlarm * alarm, clarityTimeDate * timeDate)
 {
 
@@ -243,10 +472,13 @@ int32_t configureRtcAlarmAndStandby(RTCDriver * rtcDriver, uint32_t seconds)
     RTCAlarm alarm;
     clarityTimeDate timeDate;
 
+    timingPhaseStart(TIMING_PHASE_STANDBY);
+
     memset(&alarm, 0, sizeof(alarm));
     memset(&timeDate, 0, sizeof(timeDate));
 
-    rtcRetrieve(rtcDriver, &timeDate);
+    /* The alarm is matched against the uncorrected RTC */
+    rtcRetrieveRaw(rtcDriver, &timeDate);
 
     if (clarityTimeIncrement(&timeDate, seconds) != CLARITY_SUCCESS)
     {
@@ -257,11 +489,47 @@ int32_t configureRtcAlarmAndStandby(RTCDriver * rtcDriver, uint32_t seconds)
 
     rtcSetAlarm(rtcDriver, 0, &alarm);
 
+    timingPhaseEnd(TIMING_PHASE_STANDBY);
+
     enterStandby();
 
     return 0;
 }
 
+/* Standby until the wakeup timer, clocked at 1 Hz from ck_spre, expires.
+ * Alarm A is disabled so only the timer can wake us. */
+void configureRtcWakeupAndStandby(uint32_t seconds)
+{
+    timingPhaseStart(TIMING_PHASE_STANDBY);
+
+    if (seconds == 0)
+    {
+        seconds = 1;
+    }
+    else if (seconds > RTC_WAKEUP_MAX_S)
+    {
+        seconds = RTC_WAKEUP_MAX_S;
+    }
+
+    PWR->CR |= PWR_CR_DBP;
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_ALRAE);
+    while ((RTC->ISR & RTC_ISR_WUTWF) == 0);
+
+    RTC->WUTR = seconds - 1;
+    RTC->CR = (RTC->CR & ~RTC_CR_WUCKSEL) | RTC_CR_WUCKSEL_2 | RTC_CR_WUTIE;
+    RTC->ISR &= ~RTC_ISR_WUTF;
+    RTC->CR |= RTC_CR_WUTE;
+
+    RTC->WPR = 0xFF;
+
+    timingPhaseEnd(TIMING_PHASE_STANDBY);
+
+    enterStandby();
+}
+
 int32_t updateRtcWithSntp(void)
 {
     char rxBuf[48];
@@ -282,6 +550,7 @@ int32_t updateRtcWithSntp(void)
 
     else 
     {
+        rtcClockSynced(rtcTimeDateToSeconds(&clarTime));
         rtcStore(&RTC_DRIVER, &clarTime);
     
         return 0;
@@ -313,12 +582,12 @@ void rtcTest(void)
         &&
         getInfo.date.day == setInfo.date.day) 
     {
-        PRINT("As expected", NULL);
+        PRINT("As expected");
     }
     else
     {
  
-        PRINT("NOT as expected", NULL);
+        PRINT("NOT as expected");
     }
 
 #endif
@@ -0,0 +1,118 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Periodic schedules driven by the RTC wakeup timer. Each schedule keeps the
+ * seconds until it is next due in an RTC backup register. Entering standby
+ * sleeps until the soonest schedule; on waking the sleep is taken off every
+ * schedule and those that reached zero have fired. Time spent awake is taken
+ * off before choosing the next sleep, so schedules don't slip by it. The
+ * fraction of a second left over is carried to the next wake rather than
+ * dropped, as most wakes are shorter than a second. */
+
+#include "fyp.h"
+
+static rtcBackupRegister scheduleRegister(scheduleId id)
+{
+    return (rtcBackupRegister)(BACKUP_REG_SCHEDULE + id);
+}
+
+/* Advances every schedule by elapsed seconds, reloading those that fall due.
+ * Returns a mask of (1 << scheduleId) for each schedule that fired. */
+static uint32_t schedulerAdvance(const uint32_t * periods, uint32_t elapsed)
+{
+    uint32_t fired = 0;
+    uint32_t remaining;
+    uint32_t id;
+
+    for (id = 0; id < SCHEDULES; id++)
+    {
+        remaining = rtcBackupRead(scheduleRegister(id));
+
+        if (remaining <= elapsed)
+        {
+            fired |= 1 << id;
+            /* Keep to the period rather than restarting from now */
+            remaining = periods[id] - (elapsed - remaining) % periods[id];
+        }
+        else
+        {
+            remaining -= elapsed;
+        }
+
+        rtcBackupWrite(scheduleRegister(id), remaining);
+    }
+
+    return fired;
+}
+
+/* Called once per boot. The registers survive standby and system resets,
+ * so the sleep is only taken off after a wake from standby; a reset keeps
+ * the schedules as they were. They read 0, and every schedule fires, only
+ * once the backup domain has lost power or been reset. */
+uint32_t schedulerWake(const uint32_t * periods)
+{
+    uint32_t slept = 0;
+
+    if (PWR->CSR & PWR_CSR_SBF)
+    {
+        slept = rtcBackupRead(BACKUP_REG_SCHEDULE_SLEEP);
+        PWR->CR |= PWR_CR_CSBF;
+    }
+
+    rtcBackupWrite(BACKUP_REG_SCHEDULE_SLEEP, 0);
+
+    return schedulerAdvance(periods, slept);
+}
+
+/* Sleeps until the next schedule is due. Doesn't return. */
+void schedulerStandby(void)
+{
+    uint32_t awakeMs = chTimeNow() * 1000 / CH_FREQUENCY +
+                       rtcBackupRead(BACKUP_REG_SCHEDULE_AWAKE_MS);
+    uint32_t awake = awakeMs / 1000;
+    uint32_t sleep = 0xFFFFFFFF;
+    uint32_t remaining;
+    uint32_t id;
+
+    rtcBackupWrite(BACKUP_REG_SCHEDULE_AWAKE_MS, awakeMs % 1000);
+
+    /* Anything that came due while awake is run on the next wake */
+    for (id = 0; id < SCHEDULES; id++)
+    {
+        remaining = rtcBackupRead(scheduleRegister(id));
+        remaining = remaining > awake ? remaining - awake : 1;
+        rtcBackupWrite(scheduleRegister(id), remaining);
+
+        sleep = remaining < sleep ? remaining : sleep;
+    }
+
+    sleep = sleep > RTC_WAKEUP_MAX_S ? RTC_WAKEUP_MAX_S : sleep;
+
+    rtcBackupWrite(BACKUP_REG_SCHEDULE_SLEEP, sleep);
+
+    configureRtcWakeupAndStandby(sleep);
+}
+
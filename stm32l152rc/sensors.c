@@ -0,0 +1,456 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+#include <string.h>
+#include "fyp.h"
+#include "mpl3115a2.h"
+#include "tsl2561.h"
+
+#define LOG_FILE                LOG_FILE_SENSORS
+
+#define CELSIUS_TO_KELVIN_X100  27315
+
+#define SENSOR_I2C_TIMEOUT      MS2ST(20)
+
+/* The STM32 I2C driver can't receive a single byte, so single registers are
+ * read along with the one following. */
+#define SENSOR_READ_MIN         2
+
+/* TSL2561, 1x gain and 402 ms integration. */
+#define TSL_COMMAND             0x80
+#define TSL_WORD                0x20
+#define TSL_REG_CONTROL         0x00
+#define TSL_REG_TIMING          0x01
+#define TSL_REG_DATA0           0x0C
+#define TSL_REG_DATA1           0x0E
+#define TSL_POWER_UP            0x03
+#define TSL_POWER_DOWN          0x00
+#define TSL_TIMING_402MS        0x02
+#define TSL_CONVERSION_MS       410
+
+/* MPL3115A2, barometer mode with 64x oversampling (258 ms). */
+#define MPL_REG_STATUS          0x00
+#define MPL_REG_PT_DATA_CFG     0x13
+#define MPL_REG_CTRL1           0x26
+#define MPL_PT_DATA_CFG_ALL     0x07
+#define MPL_CTRL1_OS64          0x30
+#define MPL_CTRL1_OST           0x02
+#define MPL_POLL_MS             10
+#define MPL_POLL_ATTEMPTS       20
+
+#define SENSOR_THREAD_STACK     512
+#define SENSOR_SAMPLE_PERIOD    MS2ST(5000)
+
+/* Stops the compiler moving snapshot accesses across the sequence updates.
+ * The M3 is single core so no hardware barrier is needed. */
+#define SEQ_BARRIER()           __asm__ volatile ("" ::: "memory")
+
+static I2CConfig i2cConfig;
+
+/* The latest sample is published under a sequence lock: the count is odd
+ * while the snapshot is being written, and readers retry if it was odd or
+ * changed during their copy. Readers therefore never block, and there must
+ * only ever be one writer at a time. */
+static volatile uint32_t sampleSequence;
+static sensorSample sample;
+
+static WORKING_AREA(sensorThreadWa, SENSOR_THREAD_STACK);
+static Thread * sensorThreadTp;
+static BinarySemaphore sampleReady;
+static BinarySemaphore serviceStop;
+static volatile int32_t sampleResult;
+static bool serviceSampled;
+
+void initialiseSensorHw(void)
+{
+    /* I2C for sensors */
+    palSetPadMode(I2C_PORT, I2C_SDA, PAL_MODE_ALTERNATE(4) | 
+                                     PAL_STM32_OTYPE_OPENDRAIN |
+                                     PAL_STM32_OSPEED_LOWEST);
+    palSetPadMode(I2C_PORT, I2C_SCL, PAL_MODE_ALTERNATE(4) | 
+                                     PAL_STM32_OTYPE_OPENDRAIN |
+                                     PAL_STM32_OSPEED_LOWEST);
+
+    i2cObjectInit(&I2C_DRIVER);
+
+    i2cConfig.op_mode = OPMODE_I2C;
+    i2cConfig.duty_cycle = STD_DUTY_CYCLE;
+    i2cConfig.clock_speed = 100000;
+
+    chBSemInit(&sampleReady, TRUE);
+    chBSemInit(&serviceStop, TRUE);
+    sampleSequence = 0;
+    memset(&sample, 0, sizeof(sample));
+}
+
+void deinitialiseSensorHw(void)
+{
+    /* I2C for sensors */
+    palSetPadMode(I2C_PORT, I2C_SDA, PAL_MODE_UNCONNECTED);
+    palSetPadMode(I2C_PORT, I2C_SCL, PAL_MODE_UNCONNECTED);
+
+}
+
+/* I2C2 shares its DMA channels with the CC3000's SPI2, so the SPI bus is
+ * held whenever the I2C driver is started. Both are only held for the
+ * register accesses, never across a conversion. */
+static void sensorBusAcquire(void)
+{
+    spiAcquireBus(&CC3000_SPI_DRIVER);
+    i2cAcquireBus(&I2C_DRIVER);
+    i2cStart(&I2C_DRIVER, &i2cConfig);
+}
+
+static void sensorBusRelease(void)
+{
+    i2cStop(&I2C_DRIVER);
+    i2cReleaseBus(&I2C_DRIVER);
+    spiReleaseBus(&CC3000_SPI_DRIVER);
+}
+
+static msg_t sensorWrite(i2caddr_t addr, uint8_t reg, uint8_t value)
+{
+    uint8_t tx[2] = {reg, value};
+
+    return i2cMasterTransmitTimeout(&I2C_DRIVER, addr, tx, sizeof(tx),
+                                    NULL, 0, SENSOR_I2C_TIMEOUT);
+}
+
+static msg_t sensorRead(i2caddr_t addr, uint8_t reg, uint8_t * rx, 
+                        uint32_t size)
+{
+    return i2cMasterTransmitTimeout(&I2C_DRIVER, addr, &reg, 1,
+                                    rx, size, SENSOR_I2C_TIMEOUT);
+}
+
+static msg_t tslStart(void)
+{
+    msg_t rtn;
+
+    if ((rtn = sensorWrite(TSL2561_ADDR_FLOAT, TSL_COMMAND | TSL_REG_CONTROL,
+                           TSL_POWER_UP)) != RDY_OK)
+    {
+        return rtn;
+    }
+
+    return sensorWrite(TSL2561_ADDR_FLOAT, TSL_COMMAND | TSL_REG_TIMING,
+                       TSL_TIMING_402MS);
+}
+
+/* Integer lux calculation from the TSL2561 datasheet, T package, 1x gain and
+ * 402 ms integration. */
+#define LUX_SCALE       14
+#define RATIO_SCALE     9
+#define CH_SCALE        10
+
+typedef struct {
+    uint32_t ratio;     /* Upper bound of ch1/ch0, scaled by 2^RATIO_SCALE */
+    uint32_t b;
+    uint32_t m;
+} tslCoefficients;
+
+static const tslCoefficients tslTable[] = {
+    {0x0040, 0x01F2, 0x01BE},
+    {0x0080, 0x0214, 0x02D1},
+    {0x00C0, 0x023F, 0x037B},
+    {0x0100, 0x0270, 0x03FE},
+    {0x0138, 0x016F, 0x01FC},
+    {0x019A, 0x00D2, 0x00FB},
+    {0x029A, 0x0018, 0x0012},
+    {0xFFFFFFFF, 0x0000, 0x0000}
+};
+
+static uint32_t tslCalculateLux(uint32_t ch0, uint32_t ch1)
+{
+    uint32_t chScale = (1 << CH_SCALE) << 4;    /* 1x gain */
+    uint32_t ratio = 0;
+    uint32_t i = 0;
+    int64_t lux;
+
+    ch0 = (ch0 * chScale) >> CH_SCALE;
+    ch1 = (ch1 * chScale) >> CH_SCALE;
+
+    if (ch0 != 0)
+    {
+        ratio = (((uint64_t)ch1 << (RATIO_SCALE + 1)) / ch0 + 1) >> 1;
+    }
+
+    while (ratio > tslTable[i].ratio)
+    {
+        i++;
+    }
+
+    lux = (int64_t)ch0 * tslTable[i].b - (int64_t)ch1 * tslTable[i].m;
+
+    if (lux < 0)
+    {
+        lux = 0;
+    }
+
+    return (lux + (1 << (LUX_SCALE - 1))) >> LUX_SCALE;
+}
+
+static msg_t tslFinish(int32_t * lux)
+{
+    uint8_t rx[4];
+    msg_t rtn;
+
+    if ((rtn = sensorRead(TSL2561_ADDR_FLOAT, 
+                          TSL_COMMAND | TSL_WORD | TSL_REG_DATA0,
+                          rx, 2)) != RDY_OK ||
+        (rtn = sensorRead(TSL2561_ADDR_FLOAT, 
+                          TSL_COMMAND | TSL_WORD | TSL_REG_DATA1,
+                          rx + 2, 2)) != RDY_OK)
+    {
+        return rtn;
+    }
+
+    *lux = tslCalculateLux(rx[0] | rx[1] << 8, rx[2] | rx[3] << 8);
+
+    return sensorWrite(TSL2561_ADDR_FLOAT, TSL_COMMAND | TSL_REG_CONTROL,
+                       TSL_POWER_DOWN);
+}
+
+static msg_t mplStart(void)
+{
+    msg_t rtn;
+
+    if ((rtn = sensorWrite(MPL3115A2_DEFAULT_ADDR, MPL_REG_CTRL1,
+                           MPL_CTRL1_OS64)) != RDY_OK ||
+        (rtn = sensorWrite(MPL3115A2_DEFAULT_ADDR, MPL_REG_PT_DATA_CFG,
+                           MPL_PT_DATA_CFG_ALL)) != RDY_OK)
+    {
+        return rtn;
+    }
+
+    return sensorWrite(MPL3115A2_DEFAULT_ADDR, MPL_REG_CTRL1,
+                       MPL_CTRL1_OS64 | MPL_CTRL1_OST);
+}
+
+/* Returns RDY_OK once the one shot has completed, or RDY_TIMEOUT if it is
+ * still running. */
+static msg_t mplDone(void)
+{
+    uint8_t rx[SENSOR_READ_MIN];
+    msg_t rtn;
+
+    if ((rtn = sensorRead(MPL3115A2_DEFAULT_ADDR, MPL_REG_CTRL1,
+                          rx, sizeof(rx))) != RDY_OK)
+    {
+        return rtn;
+    }
+
+    return rx[0] & MPL_CTRL1_OST ? RDY_TIMEOUT : RDY_OK;
+}
+
+static msg_t mplFinish(int32_t * temperature, int32_t * pressure)
+{
+    uint8_t rx[6];
+    uint32_t rawPressure;
+    int32_t rawTemperature;
+    msg_t rtn;
+
+    if ((rtn = sensorRead(MPL3115A2_DEFAULT_ADDR, MPL_REG_STATUS,
+                          rx, sizeof(rx))) != RDY_OK)
+    {
+        return rtn;
+    }
+
+    /* Pressure is unsigned Q18.2 Pa, temperature signed Q8.4 Celsius. */
+    rawPressure = ((uint32_t)rx[1] << 16 | rx[2] << 8 | rx[3]) >> 4;
+    rawTemperature = (int16_t)(rx[4] << 8 | rx[5]) >> 4;
+
+    *pressure = (rawPressure + 20) / 40;    /* Pa / 4 to kPa * 100 */
+    *temperature = (rawTemperature * 25 + (rawTemperature < 0 ? -2 : 2)) / 4 +
+                   CELSIUS_TO_KELVIN_X100;  /* C / 16 to K * 100 */
+
+    return RDY_OK;
+}
+
+static void samplePublish(const sensorSample * newSample)
+{
+    sampleSequence++;
+    SEQ_BARRIER();
+    memcpy(&sample, newSample, sizeof(sample));
+    SEQ_BARRIER();
+    sampleSequence++;
+}
+
+/* Reads every sensor once and replaces the snapshot. Both conversions are
+ * started together and the buses are released while they run. The
+ * MPL3115A2 returns both pressure and temperature from a single one shot
+ * conversion, so this is the only place a conversion is triggered. Must not
+ * be called while the sensor service is running. */
+int32_t sensorSampleUpdate(void)
+{
+    sensorSample newSample;
+    int32_t rtn = 0;
+    bool luxStarted;
+    bool barometerStarted;
+    uint32_t attempts;
+    msg_t done;
+
+    memset(&newSample, 0, sizeof(newSample));
+
+    sensorBusAcquire();
+    luxStarted = tslStart() == RDY_OK;
+    barometerStarted = mplStart() == RDY_OK;
+    sensorBusRelease();
+
+    chThdSleep(MS2ST(TSL_CONVERSION_MS));
+
+    sensorBusAcquire();
+
+    if (luxStarted && tslFinish(&newSample.lux) == RDY_OK)
+    {
+        newSample.luxValid = true;
+    }
+    else
+    {
+        PRINT_ERROR();
+        rtn = 1;
+    }
+
+    done = barometerStarted ? mplDone() : RDY_RESET;
+
+    for (attempts = 0; done == RDY_TIMEOUT && attempts < MPL_POLL_ATTEMPTS;
+         attempts++)
+    {
+        sensorBusRelease();
+        chThdSleep(MS2ST(MPL_POLL_MS));
+        sensorBusAcquire();
+        done = mplDone();
+    }
+
+    if (done == RDY_OK && 
+        mplFinish(&newSample.temperature, &newSample.pressure) == RDY_OK)
+    {
+        newSample.barometerValid = true;
+    }
+    else
+    {
+        PRINT_ERROR();
+        rtn = 1;
+    }
+
+    sensorBusRelease();
+
+    rtcRetrieve(&RTC_DRIVER, &newSample.timestamp);
+
+    samplePublish(&newSample);
+
+    sampleResult = rtn;
+
+    return rtn;
+}
+
+/* The only owner of the sensors while running. Samples immediately, unless
+ * the caller already has, then every SENSOR_SAMPLE_PERIOD until
+ * sensorServiceStop(). */
+static msg_t sensorThread(void * arg)
+{
+    bool sampled = serviceSampled;
+
+    (void)arg;
+
+    chRegSetThreadName("sensors");
+
+    do
+    {
+        if (sampled == false)
+        {
+            sensorSampleUpdate();
+        }
+
+        sampled = false;
+        chBSemSignal(&sampleReady);
+    } while (chBSemWaitTimeout(&serviceStop, SENSOR_SAMPLE_PERIOD) 
+                == RDY_TIMEOUT);
+
+    return 0;
+}
+
+/* Starts the sensor service. The first conversions overlap whatever the
+ * caller does next, collect them with sensorSampleWait(). If sampled, the
+ * caller's own sensorSampleUpdate() this wake is published as the first
+ * sample instead of converting again. */
+void sensorServiceStart(bool sampled)
+{
+    if (sensorThreadTp != NULL)
+    {
+        return;
+    }
+
+    chBSemReset(&sampleReady, TRUE);
+    chBSemReset(&serviceStop, TRUE);
+    serviceSampled = sampled;
+    sensorThreadTp = chThdCreateStatic(sensorThreadWa, sizeof(sensorThreadWa),
+                                       NORMALPRIO, sensorThread, NULL);
+}
+
+/* Waits for any sample in progress to finish and stops the service. */
+void sensorServiceStop(void)
+{
+    if (sensorThreadTp == NULL)
+    {
+        return;
+    }
+
+    chBSemSignal(&serviceStop);
+    chThdWait(sensorThreadTp);
+    sensorThreadTp = NULL;
+}
+
+/* Waits for the sensor service to publish a sample. Returns that sample's
+ * sensorSampleUpdate() result, or 1 if none arrived in time. */
+int32_t sensorSampleWait(systime_t timeout)
+{
+    if (chBSemWaitTimeout(&sampleReady, timeout) != RDY_OK)
+    {
+        return 1;
+    }
+
+    return sampleResult;
+}
+
+/* Copies the latest sample. Doesn't take a lock, so HTTP handlers are never
+ * held up by a conversion. */
+void sensorSampleGet(sensorSample * copy)
+{
+    uint32_t sequence;
+
+    do
+    {
+        /* Sleep rather than yield, the writer may be lower priority. */
+        while ((sequence = sampleSequence) & 1)
+        {
+            chThdSleep(1);
+        }
+
+        SEQ_BARRIER();
+        memcpy(copy, &sample, sizeof(*copy));
+        SEQ_BARRIER();
+    } while (sequence != sampleSequence);
+}
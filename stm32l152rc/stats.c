@@ -0,0 +1,154 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Runtime statistics served on /stats. One line per thread in the registry:
+ *   name priority ticks stack_free
+ * where ticks is the system ticks it has run for (CH_DBG_THREADS_PROFILING)
+ * and stack_free the bytes of its stack never written since it was created,
+ * found from the CH_DBG_FILL_THREADS fill pattern. A final line gives the
+ * uptime in ticks, free core memory and free heap and its fragment count. */
+
+#include <string.h>
+#include "fyp.h"
+
+#define LOG_FILE                LOG_FILE_STATS
+
+/* The response is built in one buffer on the stack of clarity's server
+ * thread, whose size this repo doesn't set: the body is formatted after room
+ * for the header, then moved down to follow it. */
+#define STATS_HEADER_SIZE       72
+#define STATS_BODY_SIZE         320
+#define STATS_RESPONSE_SIZE     (STATS_HEADER_SIZE + STATS_BODY_SIZE)
+
+/* The stack grows down towards p_stklimit, the fill left above it is the
+ * margin the thread has never used. */
+static uint32_t stackFree(const Thread * tp)
+{
+    const uint8_t * p = (const uint8_t *)tp->p_stklimit;
+
+    while (*p == CH_STACK_FILL_VALUE)
+    {
+        p++;
+    }
+
+    return p - (const uint8_t *)tp->p_stklimit;
+}
+
+static int32_t statsFormat(char * buf, uint32_t size)
+{
+    Thread * tp;
+    size_t heapFree;
+    size_t heapFragments;
+    uint32_t used = 0;
+    int32_t len;
+    bool truncated = false;
+
+    /* The registry holds a reference to each thread until chRegNextThread()
+     * moves past it, so the walk always runs to the end. */
+    for (tp = chRegFirstThread(); tp != NULL; tp = chRegNextThread(tp))
+    {
+        if (truncated == true)
+        {
+            continue;
+        }
+
+        len = formatText(buf + used, size - used, "%s %u %u %u\n",
+                         tp->p_name != NULL ? tp->p_name : "-",
+                         (unsigned)tp->p_prio, (unsigned)tp->p_time,
+                         (unsigned)stackFree(tp));
+
+        if (len < 0)
+        {
+            truncated = true;
+            continue;
+        }
+
+        used += len;
+    }
+
+    if (truncated == true)
+    {
+        return -1;
+    }
+
+    heapFragments = chHeapStatus(NULL, &heapFree);
+
+    len = formatText(buf + used, size - used, "up %u core %u heap %u/%u\n",
+                     (unsigned)chTimeNow(), (unsigned)chCoreStatus(),
+                     (unsigned)heapFree, (unsigned)heapFragments);
+
+    if (len < 0)
+    {
+        return -1;
+    }
+
+    return used + len;
+}
+
+uint32_t httpGetStats(const clarityHttpRequestInformation * info, 
+                      clarityConnectionInformation * conn)
+{
+    char response[STATS_RESPONSE_SIZE];
+    char * body = response + STATS_HEADER_SIZE;
+    uint32_t bodyLen;
+    int32_t headerLen;
+    int32_t responseSize;
+
+    (void)info;
+
+    if (statsFormat(body, STATS_BODY_SIZE) < 0)
+    {
+        PRINT("Stats truncated.");
+    }
+
+    bodyLen = strlen(body);
+
+    /* As clarityHttpBuildResponseTextPlain() */
+    headerLen = formatText(response, STATS_HEADER_SIZE,
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Content-Length: %u\r\n"
+                           "\r\n",
+                           (unsigned)bodyLen);
+
+    if (headerLen < 0)
+    {
+        PRINT_ERROR();
+        return 1;
+    }
+
+    memmove(response + headerLen, body, bodyLen);
+    responseSize = headerLen + bodyLen;
+
+    if (clarityHttpServerSendInCb(conn, response, responseSize) != 
+            (uint32_t)responseSize)
+    {
+        PRINT("Send failed.");
+        return 1;
+    }
+
+    return 0;
+}
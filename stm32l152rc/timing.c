@@ -0,0 +1,194 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Wake cycle phase timing. Phases are timed with the DWT cycle counter and
+ * the per phase statistics are kept in RTC backup registers so they survive
+ * standby. Each phase uses two registers:
+ *   first:  minimum (low 16 bits), maximum (high 16 bits)
+ *   second: mean (low 16 bits), samples (high 16 bits)
+ * Durations are held in ticks of 2^TIMING_TICK_SHIFT cycles and saturate. */
+
+#include "fyp.h"
+
+#define TIMING_TICK_SHIFT       12
+#define TIMING_FIELD_MAX        0xFFFF
+
+#define TIMING_LOW(reg)         ((reg) & TIMING_FIELD_MAX)
+#define TIMING_HIGH(reg)        ((reg) >> 16)
+#define TIMING_PACK(low, high)  (((uint32_t)(high) << 16) | (low))
+
+static const char * phaseNames[TIMING_PHASES] = {
+    [TIMING_PHASE_HAL_INIT]     = "hal",
+    [TIMING_PHASE_CC3000_INIT]  = "cc3000",
+    [TIMING_PHASE_ASSOCIATE]    = "associate",
+    [TIMING_PHASE_SNTP]         = "sntp",
+    [TIMING_PHASE_POST_ERROR]   = "post_error",
+    [TIMING_PHASE_POST_TIMING]  = "post_timing",
+    [TIMING_PHASE_POST_SAMPLES] = "post_samples",
+    [TIMING_PHASE_SHUTDOWN]     = "shutdown",
+    [TIMING_PHASE_STANDBY]      = "standby"
+};
+
+static uint32_t phaseStart[TIMING_PHASES];
+
+static rtcBackupRegister timingRegister(timingPhase phase)
+{
+    return (rtcBackupRegister)(BACKUP_REG_TIMING + 2 * phase);
+}
+
+/* Must run before anything that is to be timed. Doesn't depend on the HAL,
+ * so runs before halInit() has switched the clock, see ticksToUs(). */
+void timingInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void timingPhaseStart(timingPhase phase)
+{
+    phaseStart[phase] = DWT->CYCCNT;
+}
+
+/* Folds the time since timingPhaseStart() into the phase's statistics. The
+ * backup registers are written so the HAL must have been initialised. */
+void timingPhaseEnd(timingPhase phase)
+{
+    uint32_t ticks;
+    uint32_t minMax;
+    uint32_t meanCount;
+    uint32_t min;
+    uint32_t max;
+    int32_t mean;
+    uint32_t count;
+
+    ticks = (DWT->CYCCNT - phaseStart[phase]) >> TIMING_TICK_SHIFT;
+
+    if (ticks > TIMING_FIELD_MAX)
+    {
+        ticks = TIMING_FIELD_MAX;
+    }
+
+    minMax = rtcBackupRead(timingRegister(phase));
+    meanCount = rtcBackupRead(timingRegister(phase) + 1);
+    count = TIMING_HIGH(meanCount);
+
+    if (count == 0)
+    {
+        min = max = mean = ticks;
+    }
+    else
+    {
+        min = TIMING_LOW(minMax);
+        max = TIMING_HIGH(minMax);
+        mean = TIMING_LOW(meanCount);
+
+        min = ticks < min ? ticks : min;
+        max = ticks > max ? ticks : max;
+    }
+
+    /* Once the count saturates the mean becomes a slow moving average. */
+    if (count < TIMING_FIELD_MAX)
+    {
+        count++;
+    }
+
+    mean += ((int32_t)ticks - mean) / (int32_t)count;
+
+    rtcBackupWrite(timingRegister(phase), TIMING_PACK(min, max));
+    rtcBackupWrite(timingRegister(phase) + 1, TIMING_PACK(mean, count));
+}
+
+/* Restarts every phase's statistics, once they have been uploaded. */
+void timingReset(void)
+{
+    uint32_t phase;
+
+    for (phase = 0; phase < TIMING_PHASES; phase++)
+    {
+        rtcBackupWrite(timingRegister(phase), 0);
+        rtcBackupWrite(timingRegister(phase) + 1, 0);
+    }
+}
+
+/* Every tick is converted at STM32_SYSCLK, the 32 MHz PLL. The hal phase is
+ * started before halInit() switches from the 2.1 MHz MSI the core resets to,
+ * and the cycles counted before the switch each took 15 times as long, so
+ * hal is reported short. The DWT is the only timer running that early. */
+static uint32_t ticksToUs(uint32_t ticks)
+{
+    return (ticks << TIMING_TICK_SHIFT) / (STM32_SYSCLK / 1000000);
+}
+
+/* Formats the mean, minimum and maximum of each phase as batch lines, e.g.
+ * "hal_mean 120 us\nhal_min 90 us\nhal_max 250 us\n". Phases which have never
+ * run are left out. Returns the length written or -1 if buf is too small. */
+int32_t timingFormat(char * buf, uint32_t size)
+{
+    uint32_t phase;
+    uint32_t minMax;
+    uint32_t meanCount;
+    uint32_t len = 0;
+    int32_t written;
+
+    if (size == 0)
+    {
+        return -1;
+    }
+
+    buf[0] = '\0';
+
+    for (phase = 0; phase < TIMING_PHASES; phase++)
+    {
+        minMax = rtcBackupRead(timingRegister(phase));
+        meanCount = rtcBackupRead(timingRegister(phase) + 1);
+
+        if (TIMING_HIGH(meanCount) == 0)
+        {
+            continue;
+        }
+
+        written = formatText(buf + len, size - len,
+                             "%s_mean %lu us\n%s_min %lu us\n"
+                             "%s_max %lu us\n",
+                             phaseNames[phase],
+                             (unsigned long)ticksToUs(TIMING_LOW(meanCount)),
+                             phaseNames[phase],
+                             (unsigned long)ticksToUs(TIMING_LOW(minMax)),
+                             phaseNames[phase],
+                             (unsigned long)ticksToUs(TIMING_HIGH(minMax)));
+
+        if (written < 0)
+        {
+            return -1;
+        }
+
+        len += written;
+    }
+
+    return len;
+}
+
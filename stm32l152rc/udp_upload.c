@@ -0,0 +1,177 @@
+/*******************************************************************************
+* Copyright (c) 2014, Alan Barr
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* * Redistributions of source code must retain the above copyright notice, this
+*   list of conditions and the following disclaimer.
+*
+* * Redistributions in binary form must reproduce the above copyright notice,
+*   this list of conditions and the following disclaimer in the documentation
+*   and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*******************************************************************************/
+
+/* Uploads a sample as a single UDP datagram: a header of version (1),
+ * flags (1) and sequence number (4, little endian) followed by the binary
+ * measurement records. If an ack is requested the datagram is resent until
+ * the header comes back with UDP_FLAG_ACK set. Must match log_data.py. */
+
+#include <string.h>
+#include "fyp.h"
+#include "socket.h"
+
+#define LOG_FILE                LOG_FILE_UDP_UPLOAD
+
+#define UDP_VERSION             1
+#define UDP_FLAG_ACK_REQUESTED  0x01
+#define UDP_FLAG_ACK            0x02
+#define UDP_HEADER_SIZE         6
+#define UDP_DATAGRAM_SIZE       (UDP_HEADER_SIZE + 3 * MEASUREMENT_RECORD_SIZE)
+
+#define UDP_ACK_TIMEOUT_MS      500
+#define UDP_ATTEMPTS            3
+
+static uint16_t encodeHeader(uint8_t * buf, uint8_t flags, uint32_t sequence)
+{
+    buf[0] = UDP_VERSION;
+    buf[1] = flags;
+    buf[2] = sequence;
+    buf[3] = sequence >> 8;
+    buf[4] = sequence >> 16;
+    buf[5] = sequence >> 24;
+
+    return UDP_HEADER_SIZE;
+}
+
+static clarityError resolveAddress(const clarityTransportInformation * dest,
+                                   uint32_t * ip)
+{
+    if (dest->addr.type == CLARITY_ADDRESS_IP)
+    {
+        *ip = dest->addr.addr.ip;
+        return CLARITY_SUCCESS;
+    }
+
+    return addressResolve(dest->addr.addr.url, ip);
+}
+
+static bool isAck(const uint8_t * rx, int rxLen, const uint8_t * tx)
+{
+    return rxLen == UDP_HEADER_SIZE && rx[0] == UDP_VERSION && 
+           (rx[1] & UDP_FLAG_ACK) && memcmp(rx + 2, tx + 2, 4) == 0;
+}
+
+/* Sends the current sample to the address and port of dest. Without
+ * ackRequired success only means the datagram was handed to the CC3000. */
+clarityError udpPostSample(const clarityTransportInformation * dest,
+                           bool ackRequired)
+{
+    uint8_t datagram[UDP_DATAGRAM_SIZE];
+    uint8_t rx[UDP_HEADER_SIZE + 2];
+    uint16_t datagramLen;
+    uint32_t sequence;
+    uint32_t ip;
+    uint32_t attempt;
+    unsigned long timeout = UDP_ACK_TIMEOUT_MS;
+    sockaddr to;
+    sockaddr from;
+    socklen_t fromLen;
+    sensorSample sample;
+    clarityError rtn;
+    long sd;
+    int rxLen;
+
+    if ((rtn = resolveAddress(dest, &ip)) != CLARITY_SUCCESS)
+    {
+        PRINT_ERROR();
+        return rtn;
+    }
+
+    /* Every datagram gets a new number so the server can drop repeats */
+    sequence = rtcBackupRead(BACKUP_REG_UDP_SEQUENCE) + 1;
+    rtcBackupWrite(BACKUP_REG_UDP_SEQUENCE, sequence);
+
+    sensorSampleGet(&sample);
+
+    datagramLen = encodeHeader(datagram, 
+                               ackRequired ? UDP_FLAG_ACK_REQUESTED : 0,
+                               sequence);
+    datagramLen += measurementEncodeSample(datagram + datagramLen, &sample);
+
+    memset(&to, 0, sizeof(to));
+    to.sa_family = AF_INET;
+    to.sa_data[0] = dest->port >> 8;
+    to.sa_data[1] = dest->port;
+    to.sa_data[2] = ip >> 24;
+    to.sa_data[3] = ip >> 16;
+    to.sa_data[4] = ip >> 8;
+    to.sa_data[5] = ip;
+
+    chMtxLock(&cc3000ApiMutex);
+
+    if ((sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        chMtxUnlock();
+        PRINT_ERROR();
+        return CLARITY_ERROR_UNDEFINED;
+    }
+
+    if (ackRequired == true &&
+        setsockopt(sd, SOL_SOCKET, SOCKOPT_RECV_TIMEOUT,
+                   &timeout, sizeof(timeout)) < 0)
+    {
+        PRINT_ERROR();
+    }
+
+    rtn = CLARITY_ERROR_REMOTE_REQUEST;
+
+    for (attempt = 0; attempt < UDP_ATTEMPTS; attempt++)
+    {
+        if (sendto(sd, datagram, datagramLen, 0, &to, sizeof(to)) != 
+                datagramLen)
+        {
+            rtn = CLARITY_ERROR_UNDEFINED;
+            break;
+        }
+
+        if (ackRequired == false)
+        {
+            rtn = CLARITY_SUCCESS;
+            break;
+        }
+
+        fromLen = sizeof(from);
+        rxLen = recvfrom(sd, rx, sizeof(rx), 0, &from, &fromLen);
+
+        if (isAck(rx, rxLen, datagram) == true)
+        {
+            rtn = CLARITY_SUCCESS;
+            break;
+        }
+    }
+
+    closesocket(sd);
+
+    chMtxUnlock();
+
+    if (rtn != CLARITY_SUCCESS)
+    {
+        PRINT("UDP upload of %d failed.", sequence);
+    }
+
+    return rtn;
+}
+
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+#
+# Decoder for the node's deferred log, see stm32l152rc/log.c.
+#
+#   log_decode.py table fyp.h *.c > log_table.txt
+#       Builds the message table from the firmware sources. The firmware
+#       Makefile does this into its build directory on every build.
+#
+#   log_decode.py decode log_table.txt [input]
+#       Decodes the serial port output read from input, a file or a serial
+#       device already set up with stty, or stdin.
+
+import codecs
+import os
+import re
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<II")
+TICK_HZ = 1000
+
+# As fyp.h
+LOG_ID_TEXT = 1
+LOG_ID_DROPPED = 2
+MAX_ARG_WORDS = 64
+
+FILE_ENUM = re.compile(r"\b(LOG_FILE_\w+)\s*=\s*(\d+)")
+FILE_DEFINE = re.compile(r"^#define\s+LOG_FILE\s+(LOG_FILE_\w+)", re.M)
+CALL = re.compile(r"\bPRINT(_STR|_ERROR)?\s*\(")
+LITERAL = re.compile(r'\s*"((?:[^"\\]|\\.)*)"')
+CONVERSION = re.compile(r"%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l|z)?([diuxXcsp%])")
+
+def call_format(text, start):
+    if text[start - 1] != "(":
+        return None
+    parts = []
+    pos = start
+    while True:
+        m = LITERAL.match(text, pos)
+        if m is None:
+            break
+        parts.append(m.group(1))
+        pos = m.end()
+    if len(parts) == 0:
+        return None
+    return "".join(parts)
+
+def build_table(header, sources):
+    with open(header) as f:
+        files = dict(FILE_ENUM.findall(f.read()))
+    table = []
+    for path in sources:
+        with open(path) as f:
+            text = f.read()
+        define = FILE_DEFINE.search(text)
+        if define is None:
+            continue
+        file_id = int(files[define.group(1)])
+        for m in CALL.finditer(text):
+            if text[m.start() - len("define "):m.start()] == "define ":
+                continue
+            line = text.count("\n", 0, m.start()) + 1
+            if m.group(1) == "_ERROR":
+                fmt = "ERROR"
+            else:
+                fmt = call_format(text, m.end())
+                if fmt is None:
+                    continue
+            table.append("%08x %s:%d %s" % ((file_id << 16) | line,
+                                            os.path.basename(path), line, fmt))
+    return table
+
+def load_table(path):
+    table = {}
+    with open(path) as f:
+        for entry in f:
+            msg_id, where, fmt = entry.rstrip("\n").split(" ", 2)
+            fmt = codecs.decode(fmt, "unicode_escape")
+            table[int(msg_id, 16)] = (where, fmt)
+    return table
+
+def unpack_string(data):
+    return data.split(b"\0", 1)[0].decode("ascii", "replace")
+
+def format_message(fmt, words):
+    data = b"".join(struct.pack("<I", w) for w in words)
+    out = []
+    pos = 0
+    arg = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        conv = m.group(1)
+        if conv == "%":
+            out.append("%")
+        elif conv == "s":
+            # A string takes the rest of the arguments
+            out.append(unpack_string(data[arg * 4:]))
+            arg = len(words)
+        elif arg >= len(words):
+            out.append("<missing>")
+        else:
+            value = words[arg]
+            arg += 1
+            if conv in "di":
+                value = struct.unpack("<i", struct.pack("<I", value))[0]
+                out.append(("%" + m.group(0)[1:-1].rstrip("hlz") + "d") % value)
+            elif conv == "c":
+                out.append(chr(value & 0xFF))
+            else:
+                spec = m.group(0)[:-1].rstrip("hlz")
+                out.append((spec + ("x" if conv == "p" else conv)) % value)
+    out.append(fmt[pos:])
+    return "".join(out).rstrip("\r\n")
+
+def decode_record(table, msg_id, ticks, words):
+    stamp = "[%10.3f]" % (ticks / TICK_HZ)
+    if msg_id == LOG_ID_TEXT:
+        text = unpack_string(b"".join(struct.pack("<I", w) for w in words))
+        return stamp + " " + text.rstrip("\r\n")
+    if msg_id == LOG_ID_DROPPED:
+        return stamp + " (%u records dropped)" % words[0]
+    if msg_id not in table:
+        return stamp + " (unknown message %08x)" % msg_id
+    where, fmt = table[msg_id]
+    return stamp + " (" + where + ") " + format_message(fmt, words)
+
+def decode(table, stream):
+    buf = b""
+    while True:
+        data = stream.read1(4096) if hasattr(stream, "read1") else \
+               stream.read(4096)
+        if len(data) == 0:
+            break
+        buf += data
+        while True:
+            start = buf.find(SYNC)
+            if start < 0:
+                buf = buf[-1:]
+                break
+            if start > 0:
+                print("(skipped %d bytes)" % start)
+            buf = buf[start:]
+            if len(buf) < len(SYNC) + HEADER.size:
+                break
+            msg_id, header = HEADER.unpack_from(buf, len(SYNC))
+            argc = header >> 24
+            if msg_id == 0 or argc > MAX_ARG_WORDS:
+                buf = buf[1:]
+                continue
+            end = len(SYNC) + HEADER.size + argc * 4
+            if len(buf) < end:
+                break
+            words = struct.unpack_from("<%dI" % argc, buf,
+                                       len(SYNC) + HEADER.size)
+            print(decode_record(table, msg_id, header & 0xFFFFFF, words))
+            sys.stdout.flush()
+            buf = buf[end:]
+
+def main():
+    if len(sys.argv) >= 4 and sys.argv[1] == "table":
+        print("\n".join(build_table(sys.argv[2], sys.argv[3:])))
+    elif len(sys.argv) in (3, 4) and sys.argv[1] == "decode":
+        table = load_table(sys.argv[2])
+        if len(sys.argv) == 4:
+            with open(sys.argv[3], "rb", buffering = 0) as stream:
+                decode(table, stream)
+        else:
+            decode(table, sys.stdin.buffer)
+    else:
+        print("Usage: log_decode.py table fyp.h file.c ...", file = sys.stderr)
+        print("       log_decode.py decode log_table.txt [input]",
+              file = sys.stderr)
+        sys.exit(2)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,161 @@
+/* Host test vectors and microbenchmark for crc.c, against the byte wise XOR
+ * fold eeprom.c used before. The vectors are the STM32 CRC peripheral's
+ * output.
+ *
+ * Build and run from this directory:
+ *   gcc -O2 -I../../stm32l152rc crc_bench.c ../../stm32l152rc/crc.c \
+ *       -o crc_bench
+ *   ./crc_bench */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "crc.h"
+
+#define BENCH_WORDS     7           /* Header and a full record payload */
+#define ITERATIONS      1000000
+#define ERROR_TRIALS    1000000
+
+typedef struct {
+    uint32_t words[4];
+    uint32_t count;
+    uint32_t crc;
+} crcVector;
+
+static const crcVector vectors[] = {
+    {{0}, 0, 0xFFFFFFFF},
+    {{0x00000000}, 1, 0xC704DD7B},
+    {{0xFFFFFFFF}, 1, 0x00000000},
+    {{0x12345678}, 1, 0xDF8A8A2B},
+    {{0x31323334, 0x35363738}, 2, 0x49E3C2FB},
+    {{0x12345678, 0x9ABCDEF0, 0x0F1E2D3C, 0x4B5A6978}, 4, 0x376454AF},
+};
+
+/* As generateChecksum() in eeprom.c before crc.c */
+static uint32_t xorChecksum(const void * data, uint32_t bytes)
+{
+    uint32_t checksum = 0;
+    uint8_t * pChk = (uint8_t *)&checksum;
+    const uint8_t * pD = (const uint8_t *)data;
+    uint32_t index = 0;
+
+    while (bytes > 0)
+    {
+        *(pChk + index % 4) ^= *(pD + index);
+        index++;
+        bytes--;
+    }
+
+    return checksum;
+}
+
+static uint32_t xorWords(const uint32_t * data, uint32_t words)
+{
+    return xorChecksum(data, words * sizeof(uint32_t));
+}
+
+static double nanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char * name,
+                  uint32_t (*fn)(const uint32_t *, uint32_t))
+{
+    uint32_t data[BENCH_WORDS];
+    volatile uint32_t sink = 0;
+    double start;
+    uint32_t i;
+
+    for (i = 0; i < BENCH_WORDS; i++)
+    {
+        data[i] = rand();
+    }
+
+    start = nanoseconds();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        data[0] = i;
+        sink += fn(data, BENCH_WORDS);
+    }
+
+    printf("%-8s %6.2f ns per %d word record\n", name,
+           (nanoseconds() - start) / ITERATIONS, BENCH_WORDS);
+}
+
+/* Flips two random bits of a record and counts how often the checksum
+ * fails to notice. */
+static void detection(const char * name,
+                      uint32_t (*fn)(const uint32_t *, uint32_t))
+{
+    uint32_t data[BENCH_WORDS];
+    uint32_t reference;
+    uint32_t missed = 0;
+    uint32_t a;
+    uint32_t b;
+    uint32_t i;
+
+    for (i = 0; i < ERROR_TRIALS; i++)
+    {
+        for (a = 0; a < BENCH_WORDS; a++)
+        {
+            data[a] = rand();
+        }
+
+        reference = fn(data, BENCH_WORDS);
+
+        a = rand() % (BENCH_WORDS * 32);
+        do
+        {
+            b = rand() % (BENCH_WORDS * 32);
+        } while (b == a);
+
+        data[a / 32] ^= 1u << (a % 32);
+        data[b / 32] ^= 1u << (b % 32);
+
+        if (fn(data, BENCH_WORDS) == reference)
+        {
+            missed++;
+        }
+    }
+
+    printf("%-8s missed %u of %u two bit errors\n", name, missed, 
+           ERROR_TRIALS);
+}
+
+int main(void)
+{
+    uint32_t i;
+    uint32_t crc;
+    int failures = 0;
+
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        crc = crcCalculate(vectors[i].words, vectors[i].count);
+
+        if (crc != vectors[i].crc)
+        {
+            printf("Vector %u: got 0x%08X expected 0x%08X\n", i, crc,
+                   vectors[i].crc);
+            failures++;
+        }
+    }
+
+    if (failures != 0)
+    {
+        return 1;
+    }
+
+    printf("All %u test vectors pass.\n", i);
+
+    bench("xor", xorWords);
+    bench("crc", crcCalculate);
+
+    detection("xor", xorWords);
+    detection("crc", crcCalculate);
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/* Host benchmark of fixedPointFormat() against the snprintf("%.2f") path it
+ * replaced in http_sensors.c. Checks both produce the same strings first.
+ *
+ * Build and run from this directory:
+ *   gcc -O2 -I../../stm32l152rc fixed_point_bench.c \
+ *       ../../stm32l152rc/fixed_point.c -o fixed_point_bench
+ *   ./fixed_point_bench
+ *
+ * fixed_point_bench.sh also compares the Cortex-M3 flash cost of each path
+ * when arm-none-eabi-gcc is available. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "fixed_point.h"
+
+#define ITERATIONS  1000000
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static uint64_t cycles(void)
+{
+    return __rdtsc();
+}
+#define CYCLE_UNIT "cycles"
+#else
+static uint64_t cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define CYCLE_UNIT "ns"
+#endif
+
+/* As getTemperatureStr()/getPressureStr() did before fixed_point.c */
+static int floatFormat(char * buf, uint32_t size, int32_t value, unitCode unit)
+{
+    float f = value / 100.0f;
+
+    switch (unit)
+    {
+        case UNIT_CODE_LUX:
+            return snprintf(buf, size, "%d lx", (int)value);
+        case UNIT_CODE_KELVIN_X100:
+            return snprintf(buf, size, "%.2f K", f);
+        case UNIT_CODE_KPA_X100:
+            return snprintf(buf, size, "%.2f kPa", f);
+    }
+
+    return -1;
+}
+
+static int verify(void)
+{
+    static const unitCode unitList[] = {UNIT_CODE_LUX, UNIT_CODE_KELVIN_X100,
+                                        UNIT_CODE_KPA_X100};
+    char a[16];
+    char b[16];
+    int32_t value;
+    uint32_t u;
+    int failures = 0;
+
+    for (u = 0; u < sizeof(unitList) / sizeof(unitList[0]); u++)
+    {
+        for (value = 0; value < 65536; value++)
+        {
+            fixedPointFormat(a, sizeof(a), value, unitList[u]);
+            floatFormat(b, sizeof(b), value, unitList[u]);
+
+            if (strcmp(a, b) != 0)
+            {
+                if (failures++ < 10)
+                {
+                    printf("Mismatch: \"%s\" \"%s\"\n", a, b);
+                }
+            }
+        }
+    }
+
+    return failures;
+}
+
+static void bench(const char * name,
+                  int (*fn)(char *, uint32_t, int32_t, unitCode))
+{
+    char buf[16];
+    uint64_t start;
+    uint64_t total;
+    uint32_t i;
+    volatile int sink = 0;
+
+    start = cycles();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        sink += fn(buf, sizeof(buf), 27315 + (i & 0x3FF), UNIT_CODE_KELVIN_X100);
+        sink += fn(buf, sizeof(buf), 10133 + (i & 0x3FF), UNIT_CODE_KPA_X100);
+        sink += fn(buf, sizeof(buf), i & 0xFFFF, UNIT_CODE_LUX);
+    }
+    total = cycles() - start;
+
+    printf("%-18s %8.1f %s per value\n", name,
+           (double)total / (ITERATIONS * 3), CYCLE_UNIT);
+}
+
+static int fixedFormat(char * buf, uint32_t size, int32_t value, unitCode unit)
+{
+    return fixedPointFormat(buf, size, value, unit);
+}
+
+int main(void)
+{
+    int failures = verify();
+
+    if (failures != 0)
+    {
+        printf("%d mismatches against snprintf.\n", failures);
+        return 1;
+    }
+
+    printf("Output matches snprintf for 0..65535 in every unit.\n");
+
+    bench("snprintf", floatFormat);
+    bench("fixedPointFormat", fixedFormat);
+
+    return 0;
+}
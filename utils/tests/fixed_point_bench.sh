@@ -0,0 +1,56 @@
+#!/bin/sh
+# Runs fixed_point_bench.c on the host, then, if an ARM toolchain is present,
+# links a minimal Cortex-M3 image for each formatting path and reports size.
+#
+# The images are built as stm32l152rc/Makefile and ChibiOS's rules.mk build
+# the firmware: full newlib rather than nano.specs, so any snprintf() links
+# vfprintf with its soft-float conversions whatever the format. The integer
+# snprintf image shows this. nosys.specs stands in for ChibiOS's syscalls.c.
+
+FYP_DIR=../../stm32l152rc
+OUT=$(mktemp -d)
+ARM_FLAGS="-mcpu=cortex-m3 -mthumb -DTHUMB -O0 -ggdb -fomit-frame-pointer \
+           -ffunction-sections -fdata-sections -fno-common \
+           -nostartfiles -Wl,--entry=main,--gc-sections --specs=nosys.specs"
+
+gcc -O2 -I$FYP_DIR fixed_point_bench.c $FYP_DIR/fixed_point.c \
+    -o $OUT/fixed_point_bench && $OUT/fixed_point_bench
+
+if which arm-none-eabi-gcc > /dev/null
+then
+    cat > $OUT/snprintf_path.c << 'END'
+#include <stdio.h>
+char buf[16];
+volatile float value = 293.15f;
+int main(void) { return snprintf(buf, sizeof(buf), "%.2f K", value); }
+END
+
+    cat > $OUT/snprintf_int_path.c << 'END'
+#include <stdio.h>
+char buf[16];
+volatile unsigned value = 29315;
+int main(void) { return snprintf(buf, sizeof(buf), "%u", value); }
+END
+
+    cat > $OUT/fixed_point_path.c << 'END'
+#include "fixed_point.h"
+char buf[16];
+volatile int value = 29315;
+int main(void) { return fixedPointFormat(buf, sizeof(buf), value, UNIT_CODE_KELVIN_X100); }
+END
+
+    arm-none-eabi-gcc $ARM_FLAGS $OUT/snprintf_path.c \
+        -o $OUT/snprintf_path.elf
+    arm-none-eabi-gcc $ARM_FLAGS $OUT/snprintf_int_path.c \
+        -o $OUT/snprintf_int_path.elf
+    arm-none-eabi-gcc $ARM_FLAGS -I$FYP_DIR $OUT/fixed_point_path.c \
+        $FYP_DIR/fixed_point.c -o $OUT/fixed_point_path.elf
+
+    echo "Cortex-M3 image sizes:"
+    arm-none-eabi-size $OUT/snprintf_path.elf $OUT/snprintf_int_path.elf \
+        $OUT/fixed_point_path.elf
+else
+    echo "arm-none-eabi-gcc not found, skipping flash size comparison."
+fi
+
+rm -rf $OUT
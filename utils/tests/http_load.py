@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+#
+# Load generator for the node's HTTP server. Opens a number of keep-alive
+# connections and shares requests for the sensor resources between them,
+# stepping through a ramp of request rates. For each step the achieved
+# throughput, latency percentiles and error and timeout counts are printed.
+#
+# Latency is measured from when a request was due to be sent rather than when
+# it was, so a server that falls behind the offered rate shows as queueing
+# delay instead of the generator quietly slowing down. A rate of 0 sends each
+# request as soon as the last one completed.
+#
+# Against a node:
+#   ./http_load.py 10.0.0.2 80 -c 4 -r 1,2,5,10
+# Against the host simulation, serving for a minute in a single wake:
+#   stm32l152rc/host/build/fyp_sim -n 1 -s 8080 -t 60000 &
+#   ./http_load.py 127.0.0.1 8080 -c 4 -r 50,100,200,0 -d 10
+
+import argparse
+import socket
+import threading
+import time
+
+RESOURCES = ["/", "/temperature", "/pressure", "/lux"]
+RECV_SIZE = 1024
+
+class HttpTimeout(Exception):
+    pass
+
+class HttpError(Exception):
+    pass
+
+class Connection:
+    def __init__(self, host, port, timeout):
+        self.host = host
+        self.port = port
+        self.timeout = timeout
+        self.sock = None
+        self.rx = b""
+        self.connects = 0
+
+    def close(self):
+        if self.sock is not None:
+            self.sock.close()
+            self.sock = None
+            self.rx = b""
+
+    def recv_more(self):
+        data = self.sock.recv(RECV_SIZE)
+        if len(data) == 0:
+            raise HttpError("connection closed")
+        self.rx += data
+
+    # Returns the status code of the response
+    def get(self, path):
+        try:
+            if self.sock is None:
+                self.sock = socket.create_connection((self.host, self.port),
+                                                     self.timeout)
+                self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                self.connects += 1
+            request = "GET " + path + " HTTP/1.1\r\nHost: " + self.host + \
+                      "\r\n\r\n"
+            self.sock.sendall(request.encode("ascii"))
+            while b"\r\n\r\n" not in self.rx:
+                self.recv_more()
+            header, self.rx = self.rx.split(b"\r\n\r\n", 1)
+            lines = header.decode("ascii", "replace").split("\r\n")
+            status = lines[0].split()
+            if len(status) < 2 or not status[0].startswith("HTTP/"):
+                raise HttpError("bad status line: " + lines[0])
+            length = 0
+            close = status[0] == "HTTP/1.0"
+            for line in lines[1:]:
+                name, _, value = line.partition(":")
+                name = name.strip().lower()
+                if name == "content-length":
+                    length = int(value)
+                elif name == "connection":
+                    close = value.strip().lower() == "close"
+            while len(self.rx) < length:
+                self.recv_more()
+            self.rx = self.rx[length:]
+            if close:
+                self.close()
+            return int(status[1])
+        except socket.timeout:
+            self.close()
+            raise HttpTimeout()
+        except (OSError, ValueError, HttpError) as e:
+            self.close()
+            raise HttpError(str(e))
+
+class StepResult:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.errors = 0
+        self.timeouts = 0
+        self.first_error = None
+
+    def add(self, latency, error = None, timeout = False):
+        with self.lock:
+            if timeout:
+                self.timeouts += 1
+            elif error is not None:
+                self.errors += 1
+                if self.first_error is None:
+                    self.first_error = error
+            else:
+                self.latencies.append(latency)
+
+def worker(conn, index, connections, rate, duration, paths, result):
+    start = time.monotonic()
+    end = start + duration
+    # Each connection gets an equal share of the rate, staggered
+    interval = connections / rate if rate > 0 else 0
+    due = start + index * interval / connections
+    sent = 0
+    while True:
+        now = time.monotonic()
+        if rate > 0:
+            if due >= end:
+                break
+            if due > now:
+                time.sleep(due - now)
+        else:
+            if now >= end:
+                break
+            due = now
+        path = paths[(index + sent) % len(paths)]
+        sent += 1
+        try:
+            status = conn.get(path)
+            latency = time.monotonic() - due
+            if status == 200:
+                result.add(latency)
+            else:
+                result.add(latency, error = "status " + str(status))
+        except HttpTimeout:
+            result.add(None, timeout = True)
+        except HttpError as e:
+            result.add(None, error = str(e))
+            # Don't spin on a refused connection
+            time.sleep(min(interval, 0.1) if rate > 0 else 0.1)
+        due += interval
+
+def percentile(ordered, p):
+    if len(ordered) == 0:
+        return float("nan")
+    rank = int(p / 100.0 * len(ordered) + 0.5)
+    return ordered[min(max(rank, 1), len(ordered)) - 1]
+
+def run_step(conns, rate, duration, paths):
+    result = StepResult()
+    threads = []
+    for i, conn in enumerate(conns):
+        t = threading.Thread(target = worker,
+                             args = (conn, i, len(conns), rate, duration,
+                                     paths, result))
+        threads.append(t)
+        t.start()
+    started = time.monotonic()
+    for t in threads:
+        t.join()
+    return result, time.monotonic() - started
+
+def main():
+    parser = argparse.ArgumentParser(description =
+                                     "HTTP load generator for the node.")
+    parser.add_argument("host")
+    parser.add_argument("port", type = int)
+    parser.add_argument("-c", "--connections", type = int, default = 4,
+                        help = "concurrent keep-alive connections")
+    parser.add_argument("-r", "--rates", default = "1,2,5,10",
+                        help = "comma separated requests per second for "
+                               "each step, 0 for as fast as possible")
+    parser.add_argument("-d", "--duration", type = float, default = 10,
+                        help = "seconds per step")
+    parser.add_argument("-t", "--timeout", type = float, default = 2,
+                        help = "seconds before a request is a timeout")
+    parser.add_argument("-p", "--paths", default = ",".join(RESOURCES),
+                        help = "comma separated resources to request")
+    args = parser.parse_args()
+
+    rates = [float(r) for r in args.rates.split(",")]
+    paths = args.paths.split(",")
+    conns = [Connection(args.host, args.port, args.timeout)
+             for i in range(args.connections)]
+
+    print("%d connections to %s:%d, %s" %
+          (args.connections, args.host, args.port, " ".join(paths)))
+    print("%8s %8s %8s %9s %9s %9s %7s %8s" %
+          ("rate", "ok", "ok/s", "p50 ms", "p99 ms", "p999 ms", "errors",
+           "timeouts"))
+
+    for rate in rates:
+        result, elapsed = run_step(conns, rate, args.duration, paths)
+        ordered = sorted(result.latencies)
+        print("%8s %8d %8.1f %9.2f %9.2f %9.2f %7d %8d" %
+              ("max" if rate == 0 else "%g" % rate, len(ordered),
+               len(ordered) / elapsed,
+               percentile(ordered, 50) * 1000,
+               percentile(ordered, 99) * 1000,
+               percentile(ordered, 99.9) * 1000,
+               result.errors, result.timeouts))
+        if result.first_error is not None:
+            print("    first error:", result.first_error)
+
+    print("%d connections opened" % sum(c.connects for c in conns))
+
+    for conn in conns:
+        conn.close()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+#
+# Runs the host simulation against the collector in http_server, logging to
+# a temporary data directory, and checks that every upload was accepted and
+# stored: the samples and the phase timing, which is posted every
+# TIMING_UPLOAD_EVERY_N wakes. Exits non zero on failure.
+#
+#   make -C stm32l152rc/host check-collector
+# or
+#   ./sim_collector_check.py stm32l152rc/host/build/fyp_sim -n 60
+
+import argparse
+import http.client
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HTTP_SERVER_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                               "..", "..", "http_server")
+DEVICE = "cc3000"
+TIMING_DEVICE = "cc3000_timing"
+SAMPLE_RESOURCES = ["lux", "temperature", "pressure"]
+TIMING_RESOURCES = ["hal_mean", "hal_min", "hal_max", "post_samples_mean"]
+
+def start_collector(data_dir, port):
+    sys.path.insert(0, HTTP_SERVER_DIR)
+    import config
+    config.SERVER_HOST = "127.0.0.1"
+    config.SERVER_PORT = port
+    config.UDP_PORT = None
+    config.USE_I2C_MATRIX = False
+    config.DATA_DIR = data_dir
+    config.HTTP_ROOT_FILE_PATH = os.path.join(HTTP_SERVER_DIR, "data",
+                                              config.HTTP_ROOT_FILE)
+    import server
+    server.http_server_start()
+    return server
+
+def get_latest(port):
+    c = http.client.HTTPConnection("127.0.0.1", port, timeout = 10)
+    c.request("GET", "/latest")
+    lines = c.getresponse().read().decode().splitlines()[1:]
+    c.close()
+    return set(tuple(line.split(",")[:2]) for line in lines)
+
+def main():
+    parser = argparse.ArgumentParser(description =
+                                     "Check the simulation's uploads are "
+                                     "stored by the collector.")
+    parser.add_argument("sim")
+    parser.add_argument("-n", "--wakes", type = int, default = 60)
+    parser.add_argument("-p", "--port", type = int, default = 9180)
+    args = parser.parse_args()
+
+    data_dir = tempfile.mkdtemp() + "/"
+    server = start_collector(data_dir, args.port)
+    try:
+        result = subprocess.run([args.sim, "-w", "-n", str(args.wakes),
+                                 "-e", data_dir + "check.eeprom",
+                                 "-p", str(args.port), "-u", "9"],
+                                stdout = subprocess.PIPE,
+                                universal_newlines = True)
+        latest = get_latest(args.port)
+    finally:
+        server.http_server_stop()
+
+    failures = []
+    if result.returncode != 0:
+        failures.append("simulation exited with %d" % result.returncode)
+    m = re.search(r"(\d+) of (\d+) HTTP requests failed", result.stdout)
+    if m is None:
+        failures.append("no HTTP request count in the simulation's output")
+    elif m.group(1) != "0" or m.group(2) == "0":
+        failures.append(m.group(0))
+    for resource in SAMPLE_RESOURCES:
+        if (DEVICE, resource) not in latest:
+            failures.append("no " + DEVICE + "/" + resource + " stored")
+    for resource in TIMING_RESOURCES:
+        if (TIMING_DEVICE, resource) not in latest:
+            failures.append("no " + TIMING_DEVICE + "/" + resource + " stored")
+
+    for failure in failures:
+        print("FAIL: " + failure)
+    if len(failures) == 0:
+        print("OK: %s, %d resources stored" % (m.group(0), len(latest)))
+    sys.exit(len(failures) != 0)
+
+if __name__ == "__main__":
+    main()